@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * hashtable_query in a loop against hashtable_query_batch.
+ *
+ *   batch_bench [keys] [lookups] [batch]
+ *
+ * Keys default to 1<<23, which puts buckets, nodes and keys well beyond
+ * any last level cache. Half of the lookups miss.
+ */
+
+#include "../include/hashtable.h"
+#include "../include/hashfunc.h"
+
+static bool bench_equal(void * data1, void * data2){
+    return *(uint64_t*)data1 == *(uint64_t*)data2;
+}
+
+static double bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(int argc, char ** argv){
+    hash_type nkeys = argc > 1 ? strtoull(argv[1], NULL, 10) : (hash_type)1 << 23;
+    hash_type lookups = argc > 2 ? strtoull(argv[2], NULL, 10) : 10000000;
+    size_t batch = argc > 3 ? strtoull(argv[3], NULL, 10) : 256;
+    struct hashtable * table;
+    uint64_t * keys, * probes, rng = 0x9E3779B97F4A7C15ULL;
+    void ** probe_ptrs, ** results;
+    hash_type i, hits_scalar = 0, hits_batch = 0;
+    double start, scalar, batched;
+
+    keys = (uint64_t*)malloc(nkeys * sizeof(uint64_t));
+    probes = (uint64_t*)malloc(lookups * sizeof(uint64_t));
+    probe_ptrs = (void**)malloc(lookups * sizeof(void*));
+    results = (void**)malloc(batch * sizeof(void*));
+    if(!keys || !probes || !probe_ptrs || !results) hashtable_insufficient_memory_error();
+
+    table = hashtable_init_size(hash64_uint64_t, bench_equal, nkeys, NULL);
+    for(i = 0; i < nkeys; i++){
+        keys[i] = i * 2;
+        hashtable_insert(table, &keys[i]);
+    }
+    for(i = 0; i < lookups; i++){
+        rng ^= rng << 13;
+        rng ^= rng >> 7;
+        rng ^= rng << 17;
+        probes[i] = rng % (nkeys * 2);
+        probe_ptrs[i] = &probes[i];
+    }
+
+    start = bench_now();
+    for(i = 0; i < lookups; i++)
+        hits_scalar += hashtable_query(table, probe_ptrs[i]) != NULL;
+    scalar = bench_now() - start;
+
+    start = bench_now();
+    for(i = 0; i < lookups; i += batch){
+        size_t j, n = lookups - i < batch ? lookups - i : batch;
+        hashtable_query_batch(table, probe_ptrs + i, n, results);
+        for(j = 0; j < n; j++) hits_batch += results[j] != NULL;
+    }
+    batched = bench_now() - start;
+
+    printf("keys,lookups,batch,scalar_ns_per_op,batch_ns_per_op,speedup\n");
+    printf("%llu,%llu,%zu,%.2f,%.2f,%.2f\n", (unsigned long long)nkeys, (unsigned long long)lookups, batch,
+           scalar * 1e9 / lookups, batched * 1e9 / lookups, scalar / batched);
+    if(hits_scalar != hits_batch)
+        fprintf(stderr, "hit count mismatch: %llu vs %llu\n",
+                (unsigned long long)hits_scalar, (unsigned long long)hits_batch);
+
+    hashtable_free(table, NULL);
+    free(keys);
+    free(probes);
+    free(probe_ptrs);
+    free(results);
+    return hits_scalar != hits_batch;
+}
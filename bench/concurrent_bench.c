@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Scaling benchmark for struct hashtable_concurrent.
+ *
+ *   concurrent_bench [max_threads] [keys] [ops_per_thread] [read_percent]
+ *
+ * The table is prefilled with half of the keys. Every thread then runs a
+ * mix of lookups over all keys and insert/delete toggles over its own slice
+ * of the keys (so writes never conflict logically, only on stripes), for
+ * 1, 2, 4, ... max_threads threads, and reports ops/sec for each.
+ */
+
+#include "../include/hashtable_concurrent.h"
+#include "../include/hashfunc.h"
+
+#include <unistd.h>
+
+struct bench_thread{
+    pthread_t                       thread;
+    struct hashtable_concurrent *   table;
+    uint64_t *                      keys;
+    uint8_t *                       present;
+    hash_type                       nkeys,first,last,ops;
+    unsigned                        read_percent;
+    uint64_t                        rng;
+};
+
+static bool bench_equal(void * data1, void * data2){
+    return *(uint64_t*)data1 == *(uint64_t*)data2;
+}
+
+static inline uint64_t bench_rand(uint64_t * state){
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static double bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void * bench_worker(void * _arg){
+    struct bench_thread * arg = (struct bench_thread*)_arg;
+    hash_type i, key;
+    volatile void * sink;
+
+    for(i = 0; i < arg->ops; i++){
+        if(bench_rand(&arg->rng) % 100 < arg->read_percent){
+            sink = hashtable_concurrent_query(arg->table, &arg->keys[bench_rand(&arg->rng) % arg->nkeys]);
+            (void)sink;
+        }else{
+            key = arg->first + bench_rand(&arg->rng) % (arg->last - arg->first);
+            if(arg->present[key]) hashtable_concurrent_delete(arg->table, &arg->keys[key], NULL);
+            else hashtable_concurrent_insert(arg->table, &arg->keys[key]);
+            arg->present[key] ^= 1;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char ** argv){
+    unsigned max_threads = argc > 1 ? (unsigned)atoi(argv[1]) : (unsigned)sysconf(_SC_NPROCESSORS_ONLN);
+    hash_type nkeys = argc > 2 ? strtoull(argv[2], NULL, 10) : 1000000;
+    hash_type ops = argc > 3 ? strtoull(argv[3], NULL, 10) : 2000000;
+    unsigned read_percent = argc > 4 ? (unsigned)atoi(argv[4]) : 90;
+    struct bench_thread * threads;
+    struct hashtable_concurrent * table;
+    uint64_t * keys;
+    uint8_t * present;
+    unsigned nthreads, t;
+    hash_type i;
+    double start, elapsed, base = 0;
+
+    if(max_threads < 1) max_threads = 1;
+    keys = (uint64_t*)malloc(nkeys * sizeof(uint64_t));
+    present = (uint8_t*)malloc(nkeys);
+    threads = (struct bench_thread*)calloc(max_threads, sizeof(struct bench_thread));
+    if(!keys || !present || !threads) hashtable_insufficient_memory_error();
+    for(i = 0; i < nkeys; i++) keys[i] = i * 0x9E3779B97F4A7C15ULL;
+
+    printf("threads,ops_per_sec,speedup\n");
+    for(nthreads = 1; ; nthreads = nthreads*2 < max_threads ? nthreads*2 : max_threads){
+        table = hashtable_concurrent_init(hash_uint64_t, bench_equal);
+        for(i = 0; i < nkeys; i++){
+            present[i] = i % 2;
+            if(present[i]) hashtable_concurrent_insert(table, &keys[i]);
+        }
+        for(t = 0; t < nthreads; t++){
+            threads[t].table = table;
+            threads[t].keys = keys;
+            threads[t].present = present;
+            threads[t].nkeys = nkeys;
+            threads[t].first = nkeys * t / nthreads;
+            threads[t].last = nkeys * (t+1) / nthreads;
+            threads[t].ops = ops;
+            threads[t].read_percent = read_percent;
+            threads[t].rng = 0x2545F4914F6CDD1DULL * (t+1);
+        }
+        start = bench_now();
+        for(t = 0; t < nthreads; t++)
+            pthread_create(&threads[t].thread, NULL, bench_worker, &threads[t]);
+        for(t = 0; t < nthreads; t++)
+            pthread_join(threads[t].thread, NULL);
+        elapsed = bench_now() - start;
+
+        if(nthreads == 1) base = ops / elapsed;
+        printf("%u,%.0f,%.2f\n", nthreads, nthreads * ops / elapsed, nthreads * ops / elapsed / base);
+        fflush(stdout);
+        hashtable_concurrent_free(table, NULL);
+        if(nthreads == max_threads) break;
+    }
+
+    free(keys);
+    free(present);
+    free(threads);
+    return 0;
+}
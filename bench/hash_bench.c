@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Compares the hash_* and hash64_* families.
+ *
+ *   throughput   ns per hash and GB/s for strings of several lengths,
+ *                ns per hash for 64 bit integers
+ *   avalanche    for random inputs, flips every input bit and reports the
+ *                mean fraction of output bits that change (ideal 0.5) and
+ *                the worst input/output bit bias (ideal 0)
+ *   collisions   buckets used the way struct hashtable does (top bits of
+ *                seed * hash) for sequential integers, strings with a
+ *                common prefix and floats one tenth apart; reports the
+ *                longest chain and the share of distinct full hashes
+ */
+
+#include "../include/hashfunc.h"
+
+#define BENCH_AVALANCHE_SAMPLES     (20000)
+#define BENCH_COLLISION_KEYS        (1 << 16)
+
+struct bench_hash{
+    const char *    name;
+    hash_type       (*hash_func)(void * data);
+};
+
+static double bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static uint64_t bench_rand(uint64_t * state){
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+static int bench_compare(const void * a, const void * b){
+    hash_type x = *(const hash_type*)a, y = *(const hash_type*)b;
+    return x < y ? -1 : x > y;
+}
+
+static void bench_string_throughput(const struct bench_hash * hash, size_t length){
+    char * buffer = (char*)malloc(length + 64);
+    hash_type i, rounds = (hash_type)(200000000 / (length + 8)), sink = 0;
+    double start, elapsed;
+
+    for(i = 0; i < length; i++) buffer[i] = (char)('a' + i % 26);
+    buffer[length] = '\0';
+
+    start = bench_now();
+    for(i = 0; i < rounds; i++){
+        buffer[i % length] ^= 1;
+        sink += hash->hash_func(buffer);
+    }
+    elapsed = bench_now() - start;
+    printf("%-16s %6zu %10.2f %8.2f   (%llx)\n", hash->name, length,
+           elapsed * 1e9 / rounds, rounds * (double)length / elapsed / 1e9,
+           (unsigned long long)(sink & 0xf));
+    free(buffer);
+}
+
+static void bench_integer_throughput(const struct bench_hash * hash){
+    hash_type i, rounds = 100000000, sink = 0;
+    uint64_t value = 0;
+    double start, elapsed;
+
+    start = bench_now();
+    for(i = 0; i < rounds; i++){
+        value += 0x9E3779B97F4A7C15ULL;
+        sink += hash->hash_func(&value);
+    }
+    elapsed = bench_now() - start;
+    printf("%-16s %10.2f   (%llx)\n", hash->name, elapsed * 1e9 / rounds, (unsigned long long)(sink & 0xf));
+}
+
+/* Inputs are 8 byte values; strings are 8 printable bytes with one bit flipped inside the low 7 bits of a byte */
+static void bench_avalanche(const struct bench_hash * hash, bool string){
+    static uint32_t flips[64][64];
+    uint64_t rng = 0x853c49e6748fea9bULL, input, flipped;
+    char buffer[9], buffer_flipped[9];
+    hash_type base, out, i;
+    int bit, obit, bits = string ? 56 : 64;
+    double total = 0, worst = 0, bias;
+
+    memset(flips, 0, sizeof(flips));
+    for(i = 0; i < BENCH_AVALANCHE_SAMPLES; i++){
+        input = bench_rand(&rng);
+        if(string){
+            for(bit = 0; bit < 8; bit++) buffer[bit] = (char)(0x40 | ((input >> (bit*8)) & 0x3f));
+            buffer[8] = '\0';
+            base = hash->hash_func(buffer);
+        }else{
+            base = hash->hash_func(&input);
+        }
+        for(bit = 0; bit < bits; bit++){
+            if(string){
+                memcpy(buffer_flipped, buffer, sizeof(buffer));
+                buffer_flipped[bit / 7] ^= (char)(1 << (bit % 7));
+                if(buffer_flipped[bit / 7] == 0) buffer_flipped[bit / 7] = 0x7f;
+                out = hash->hash_func(buffer_flipped);
+            }else{
+                flipped = input ^ ((uint64_t)1 << bit);
+                out = hash->hash_func(&flipped);
+            }
+            out ^= base;
+            for(obit = 0; obit < 64; obit++)
+                flips[bit][obit] += (out >> obit) & 1;
+        }
+    }
+    for(bit = 0; bit < bits; bit++){
+        for(obit = 0; obit < 64; obit++){
+            bias = fabs((double)flips[bit][obit] / BENCH_AVALANCHE_SAMPLES - 0.5) * 2;
+            worst = bias > worst ? bias : worst;
+            total += (double)flips[bit][obit] / BENCH_AVALANCHE_SAMPLES;
+        }
+    }
+    printf("%-16s %10.4f %10.4f\n", hash->name, total / (bits * 64), worst);
+}
+
+static void bench_collisions(const char * workload,
+                             const struct bench_hash * hash,
+                             void * (*key)(hash_type i, void * scratch)){
+    static uint32_t chains[BENCH_COLLISION_KEYS];
+    static hash_type hashes[BENCH_COLLISION_KEYS];
+    char scratch[64];
+    uint64_t seed = 0x9E3779B97F4A7C15ULL;
+    uint8_t exponent = 16;
+    hash_type i, distinct, biggest = 0;
+
+    memset(chains, 0, sizeof(chains));
+    for(i = 0; i < BENCH_COLLISION_KEYS; i++){
+        hashes[i] = hash->hash_func(key(i, scratch));
+        chains[(seed * hashes[i]) >> (HASHTABLE_WORD_SIZE - exponent)]++;
+    }
+    for(i = 0; i < BENCH_COLLISION_KEYS; i++)
+        biggest = chains[i] > biggest ? chains[i] : biggest;
+    qsort(hashes, BENCH_COLLISION_KEYS, sizeof(hash_type), bench_compare);
+    for(i = 1, distinct = 1; i < BENCH_COLLISION_KEYS; i++)
+        distinct += hashes[i] != hashes[i-1];
+    printf("%-12s %-16s %8llu %9.2f%%\n", workload, hash->name,
+           (unsigned long long)biggest, 100.0 * distinct / BENCH_COLLISION_KEYS);
+}
+
+static void * bench_key_sequential(hash_type i, void * scratch){
+    *(uint64_t*)scratch = i << 16;
+    return scratch;
+}
+
+static void * bench_key_prefixed(hash_type i, void * scratch){
+    snprintf((char*)scratch, 64, "session:user:%llu", (unsigned long long)i);
+    return scratch;
+}
+
+static void * bench_key_tenths(hash_type i, void * scratch){
+    *(double*)scratch = i * 0.1;
+    return scratch;
+}
+
+int main(void){
+    static const struct bench_hash strings[] = {
+        {"hash_string", hash_string}, {"hash64_string", hash64_string}};
+    static const struct bench_hash integers[] = {
+        {"hash_uint64_t", hash_uint64_t}, {"hash64_uint64_t", hash64_uint64_t}};
+    static const struct bench_hash doubles[] = {
+        {"hash_double", hash_double}, {"hash64_double", hash64_double}};
+    static const size_t lengths[] = {4, 8, 16, 32, 64, 256, 1024, 4096};
+    size_t i, j;
+
+    printf(" * String throughput *\n%-16s %6s %10s %8s\n", "function", "bytes", "ns/hash", "GB/s");
+    for(j = 0; j < sizeof(lengths)/sizeof(lengths[0]); j++)
+        for(i = 0; i < 2; i++) bench_string_throughput(&strings[i], lengths[j]);
+
+    printf("\n * Integer throughput *\n%-16s %10s\n", "function", "ns/hash");
+    for(i = 0; i < 2; i++) bench_integer_throughput(&integers[i]);
+
+    printf("\n * Avalanche *\n%-16s %10s %10s\n", "function", "mean", "worst bias");
+    for(i = 0; i < 2; i++) bench_avalanche(&integers[i], false);
+    for(i = 0; i < 2; i++) bench_avalanche(&strings[i], true);
+
+    printf("\n * Collisions (%d keys, %d buckets) *\n%-12s %-16s %8s %10s\n",
+           BENCH_COLLISION_KEYS, BENCH_COLLISION_KEYS, "keys", "function", "longest", "distinct");
+    for(i = 0; i < 2; i++) bench_collisions("sequential", &integers[i], bench_key_sequential);
+    for(i = 0; i < 2; i++) bench_collisions("prefixed", &strings[i], bench_key_prefixed);
+    for(i = 0; i < 2; i++) bench_collisions("tenths", &doubles[i], bench_key_tenths);
+    return 0;
+}
@@ -0,0 +1,397 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/*
+ * Regression benchmark for struct hashtable.
+ *
+ *   table_bench [sizes] [distributions] [hash] [filter_bits]
+ *
+ *   sizes          comma separated key counts,
+ *                  default 1000,10000,100000,1000000,10000000,100000000
+ *   distributions  comma separated subset of uniform,zipfian,sequential,
+ *                  adversarial, default all
+ *   hash           hash64 (hash64_uint64_t, default) or identity
+ *                  (hash_uint64_t)
+ *   filter_bits    bits per bucket of the membership filter
+ *                  (hashtable_set_filter), default 0 (no filter)
+ *
+ * Keys are 64 bit integers:
+ *
+ *   uniform        scrambled keys, looked up uniformly at random
+ *   zipfian        scrambled keys, looked up with Zipf(0.99) popularity
+ *   sequential     keys 0..n-1, inserted and looked up in order
+ *   adversarial    keys i << 32, i.e. differing only in their high half,
+ *                  which defeats hashes that truncate or fold; looked up
+ *                  uniformly at random
+ *
+ * For every size and distribution, insert, query_hit, query_miss,
+ * get_or_insert (counting hits on existing keys), optimize, delete and
+ * build_from_array (hashtable_build_from_array on all online CPUs, per key)
+ * are measured and one CSV line per operation is written to stdout:
+ *
+ *   distribution,hash,size,op,ops,ns_per_op,p50_ns,p90_ns,p99_ns,p999_ns,
+ *   peak_rss_kb,cache_misses_per_op,cache_references_per_op
+ *
+ * Small tables are rebuilt until at least BENCH_MIN_OPS inserts and
+ * deletes have been timed. Percentiles are over blocks of BENCH_BLOCK
+ * operations, since the clock costs as much as a single lookup. Cache
+ * counters come from perf_event_open and read -1 where it is unavailable
+ * (no PMU, or perf_event_paranoid forbids it). peak_rss_kb is the process
+ * high water mark, reset before every size where the kernel allows it.
+ */
+
+#include "../include/hashtable.h"
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+
+#include <unistd.h>
+#include <sys/resource.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#define BENCH_BLOCK                 (32)
+#define BENCH_MIN_OPS               ((hash_type)1 << 20)
+#define BENCH_MAX_QUERIES           ((hash_type)1 << 24)
+#define BENCH_ZIPF_THETA            (0.99)
+
+enum bench_distribution{
+    BENCH_UNIFORM,
+    BENCH_ZIPFIAN,
+    BENCH_SEQUENTIAL,
+    BENCH_ADVERSARIAL,
+    BENCH_DISTRIBUTIONS
+};
+
+static const char * bench_distribution_names[BENCH_DISTRIBUTIONS] = {
+    "uniform", "zipfian", "sequential", "adversarial"};
+
+struct bench_phase{
+    const char *    name;
+    hash_type       ops,blocks,capacity;
+    double          elapsed;
+    double *        samples;
+    long long       misses,references;
+};
+
+struct bench_zipf{
+    hash_type       n;
+    double          theta,alpha,zetan,eta,half_pow_theta;
+};
+
+static int bench_cache_misses = -1, bench_cache_references = -1;
+
+static double bench_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static inline uint64_t bench_rand(uint64_t * state){
+    uint64_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 7;
+    x ^= x << 17;
+    return *state = x;
+}
+
+/* Gray et al., "Quickly generating billion-record synthetic databases" */
+static void bench_zipf_init(struct bench_zipf * zipf, hash_type n, double theta){
+    hash_type i;
+    double zeta2 = 1 + pow(0.5, theta);
+
+    zipf->n = n;
+    zipf->theta = theta;
+    zipf->zetan = 0;
+    for(i = 1; i <= n; i++) zipf->zetan += 1 / pow((double)i, theta);
+    zipf->alpha = 1 / (1 - theta);
+    zipf->eta = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zipf->zetan);
+    zipf->half_pow_theta = pow(0.5, theta);
+}
+
+static hash_type bench_zipf_next(const struct bench_zipf * zipf, uint64_t * rng){
+    double u = (bench_rand(rng) >> 11) * (1.0 / 9007199254740992.0), uz = u * zipf->zetan;
+    hash_type rank;
+
+    if(uz < 1) return 0;
+    if(uz < 1 + zipf->half_pow_theta) return 1 < zipf->n ? 1 : 0;
+    rank = (hash_type)(zipf->n * pow(zipf->eta * u - zipf->eta + 1, zipf->alpha));
+    return rank < zipf->n ? rank : zipf->n - 1;
+}
+
+#if defined(__linux__)
+static int bench_perf_open(uint64_t config){
+    struct perf_event_attr attr;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.config = config;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
+#endif
+
+static void bench_perf_init(void){
+#if defined(__linux__)
+    bench_cache_misses = bench_perf_open(PERF_COUNT_HW_CACHE_MISSES);
+    bench_cache_references = bench_perf_open(PERF_COUNT_HW_CACHE_REFERENCES);
+#endif
+}
+
+static long long bench_perf_read(int fd){
+    uint64_t value;
+
+    if(fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) return -1;
+    return (long long)value;
+}
+
+static void bench_reset_peak_rss(void){
+    FILE * fp = fopen("/proc/self/clear_refs", "w");
+
+    if(fp){
+        fputs("5", fp);
+        fclose(fp);
+    }
+}
+
+static long bench_peak_rss(void){
+    struct rusage usage;
+    char line[256];
+    long kb = -1;
+    FILE * fp = fopen("/proc/self/status", "r");
+
+    if(fp){
+        while(fgets(line, sizeof(line), fp))
+            if(sscanf(line, "VmHWM: %ld kB", &kb) == 1) break;
+        fclose(fp);
+    }
+    if(kb < 0 && getrusage(RUSAGE_SELF, &usage) == 0) kb = usage.ru_maxrss;
+    return kb;
+}
+
+static void bench_phase_init(struct bench_phase * phase, const char * name, hash_type capacity){
+    phase->name = name;
+    phase->ops = phase->blocks = 0;
+    phase->capacity = capacity / BENCH_BLOCK + 2;
+    phase->elapsed = 0;
+    phase->misses = phase->references = 0;
+    if((phase->samples = (double*)malloc(phase->capacity * sizeof(double))) == NULL)
+        hashtable_insufficient_memory_error();
+}
+
+static void bench_phase_counters(struct bench_phase * phase, int sign){
+    long long misses = bench_perf_read(bench_cache_misses), references = bench_perf_read(bench_cache_references);
+
+    phase->misses = misses < 0 || phase->misses < 0 ? -1 : phase->misses + sign * misses;
+    phase->references = references < 0 || phase->references < 0 ? -1 : phase->references + sign * references;
+}
+
+static inline void bench_phase_sample(struct bench_phase * phase, double elapsed, hash_type ops){
+    if(phase->blocks < phase->capacity) phase->samples[phase->blocks++] = elapsed * 1e9 / ops;
+    phase->elapsed += elapsed;
+    phase->ops += ops;
+}
+
+/* Times operation for i in [0, count) in blocks of BENCH_BLOCK */
+#define BENCH_TIMED(phase, count, operation)                                            \
+    do{                                                                                 \
+        hash_type i, block, end, total = (count);                                       \
+        double start;                                                                   \
+        bench_phase_counters(phase, -1);                                                \
+        for(block = 0; block < total; block = end){                                     \
+            end = block + BENCH_BLOCK < total ? block + BENCH_BLOCK : total;            \
+            start = bench_now();                                                        \
+            for(i = block; i < end; i++){ operation; }                                  \
+            bench_phase_sample(phase, bench_now() - start, end - block);                \
+        }                                                                               \
+        bench_phase_counters(phase, 1);                                                 \
+    }while(0)
+
+static int bench_compare(const void * a, const void * b){
+    double x = *(const double*)a, y = *(const double*)b;
+    return x < y ? -1 : x > y;
+}
+
+static double bench_percentile(const struct bench_phase * phase, double q){
+    return phase->blocks ? phase->samples[(hash_type)(q * (phase->blocks - 1))] : 0;
+}
+
+static void bench_phase_report(struct bench_phase * phase,
+                               const char * distribution,
+                               const char * hash,
+                               hash_type size){
+    qsort(phase->samples, phase->blocks, sizeof(double), bench_compare);
+    printf("%s,%s,%llu,%s,%llu,%.2f,%.2f,%.2f,%.2f,%.2f,%ld,",
+           distribution, hash, (unsigned long long)size, phase->name, (unsigned long long)phase->ops,
+           phase->ops ? phase->elapsed * 1e9 / phase->ops : 0,
+           bench_percentile(phase, 0.5), bench_percentile(phase, 0.9),
+           bench_percentile(phase, 0.99), bench_percentile(phase, 0.999),
+           bench_peak_rss());
+    if(phase->misses < 0) printf("-1,");
+    else printf("%.3f,", (double)phase->misses / phase->ops);
+    if(phase->references < 0) printf("-1\n");
+    else printf("%.3f\n", (double)phase->references / phase->ops);
+    fflush(stdout);
+    free(phase->samples);
+}
+
+static uint64_t bench_key(enum bench_distribution distribution, hash_type i){
+    switch(distribution){
+        case BENCH_SEQUENTIAL:  return i;
+        case BENCH_ADVERSARIAL: return i << 32;
+        default:                return hash64_mix(i);
+    }
+}
+
+static void bench_run(enum bench_distribution distribution,
+                      const char * hash_name,
+                      hash_type (*hash_func)(void * data),
+                      unsigned filter_bits,
+                      hash_type size){
+    hash_type queries = size < BENCH_MIN_OPS ? BENCH_MIN_OPS : size > BENCH_MAX_QUERIES ? BENCH_MAX_QUERIES : size;
+    hash_type rounds = (BENCH_MIN_OPS + size - 1) / size, round, hits = 0;
+    struct bench_phase insert, query_hit, query_miss, get_or_insert, optimize, delete, build;
+    struct hashtable * table;
+    struct bench_zipf zipf;
+    uint64_t * keys, * hit_probes, * miss_probes, rng = 0x9E3779B97F4A7C15ULL;
+    hash_type i;
+    void ** slot, ** key_pointers;
+    long threads = sysconf(_SC_NPROCESSORS_ONLN);
+    double start;
+
+    bench_reset_peak_rss();
+    keys = (uint64_t*)malloc(size * sizeof(uint64_t));
+    hit_probes = (uint64_t*)malloc(queries * sizeof(uint64_t));
+    miss_probes = (uint64_t*)malloc(queries * sizeof(uint64_t));
+    key_pointers = (void**)malloc(size * sizeof(void*));
+    if(!keys || !hit_probes || !miss_probes || !key_pointers) hashtable_insufficient_memory_error();
+
+    for(i = 0; i < size; i++){
+        keys[i] = bench_key(distribution, i);
+        key_pointers[i] = &keys[i];
+    }
+    if(distribution == BENCH_ZIPFIAN) bench_zipf_init(&zipf, size, BENCH_ZIPF_THETA);
+    for(i = 0; i < queries; i++){
+        switch(distribution){
+            case BENCH_SEQUENTIAL:  hit_probes[i] = keys[i % size]; break;
+            case BENCH_ZIPFIAN:     hit_probes[i] = keys[bench_zipf_next(&zipf, &rng)]; break;
+            default:                hit_probes[i] = keys[bench_rand(&rng) % size]; break;
+        }
+        miss_probes[i] = bench_key(distribution, size + (distribution == BENCH_SEQUENTIAL ? i : bench_rand(&rng) % size));
+    }
+
+    bench_phase_init(&insert, "insert", rounds * size);
+    bench_phase_init(&query_hit, "query_hit", queries);
+    bench_phase_init(&query_miss, "query_miss", queries);
+    bench_phase_init(&get_or_insert, "get_or_insert", queries);
+    bench_phase_init(&optimize, "optimize", 1);
+    bench_phase_init(&delete, "delete", rounds * size);
+    bench_phase_init(&build, "build_from_array", rounds * BENCH_BLOCK);
+
+    for(round = 0; round < rounds; round++){
+        table = hashtable_init(hash_func, equal_uint64_t);
+        hashtable_set_filter(table, filter_bits);
+        BENCH_TIMED(&insert, size, hashtable_insert(table, &keys[i]));
+        if(round == rounds - 1){
+            BENCH_TIMED(&query_hit, queries, hits += hashtable_query(table, &hit_probes[i]) != NULL);
+            BENCH_TIMED(&query_miss, queries, hits += hashtable_query(table, &miss_probes[i]) != NULL);
+            BENCH_TIMED(&get_or_insert, queries,
+                        slot = hashtable_get_or_insert(table, &hit_probes[i], NULL);
+                        *slot = (void*)((uintptr_t)*slot + 1));
+            BENCH_TIMED(&optimize, 1, hashtable_optimize(table));
+        }
+        BENCH_TIMED(&delete, size, hashtable_delete(table, &keys[i], NULL));
+        hashtable_free(table, NULL);
+    }
+    for(round = 0; round < rounds; round++){
+        bench_phase_counters(&build, -1);
+        start = bench_now();
+        table = hashtable_build_from_array(hash_func, equal_uint64_t, key_pointers, size, threads > 0 ? (unsigned)threads : 1);
+        bench_phase_sample(&build, bench_now() - start, size);
+        bench_phase_counters(&build, 1);
+        hashtable_free(table, NULL);
+    }
+    if(hits != queries)
+        fprintf(stderr, "%s/%llu: %llu of %llu lookups answered wrong\n", bench_distribution_names[distribution],
+                (unsigned long long)size, (unsigned long long)(hits > queries ? hits - queries : queries - hits),
+                (unsigned long long)queries);
+
+    bench_phase_report(&insert, bench_distribution_names[distribution], hash_name, size);
+    bench_phase_report(&query_hit, bench_distribution_names[distribution], hash_name, size);
+    bench_phase_report(&query_miss, bench_distribution_names[distribution], hash_name, size);
+    bench_phase_report(&get_or_insert, bench_distribution_names[distribution], hash_name, size);
+    bench_phase_report(&optimize, bench_distribution_names[distribution], hash_name, size);
+    bench_phase_report(&delete, bench_distribution_names[distribution], hash_name, size);
+    bench_phase_report(&build, bench_distribution_names[distribution], hash_name, size);
+
+    free(keys);
+    free(hit_probes);
+    free(miss_probes);
+    free(key_pointers);
+}
+
+int main(int argc, char ** argv){
+    static const hash_type default_sizes[] = {1000, 10000, 100000, 1000000, 10000000, 100000000};
+    char sizes_buffer[1024], distributions_buffer[256], * token;
+    const char * hash_name = argc > 3 ? argv[3] : "hash64";
+    unsigned filter_bits = argc > 4 ? (unsigned)strtoul(argv[4], NULL, 10) : 0;
+    hash_type (*hash_func)(void * data) = hash64_uint64_t;
+    hash_type sizes[64], nsizes = 0, i;
+    bool enabled[BENCH_DISTRIBUTIONS];
+    int d;
+
+    if(strcmp(hash_name, "identity") == 0){
+        hash_func = hash_uint64_t;
+    }else if(strcmp(hash_name, "hash64") != 0){
+        fprintf(stderr, "unknown hash %s, expected hash64 or identity\n", hash_name);
+        return EXIT_FAILURE;
+    }
+
+    if(argc > 1){
+        snprintf(sizes_buffer, sizeof(sizes_buffer), "%s", argv[1]);
+        for(token = strtok(sizes_buffer, ","); token && nsizes < 64; token = strtok(NULL, ","))
+            if((sizes[nsizes] = strtoull(token, NULL, 10)) > 0) nsizes++;
+    }else{
+        for(nsizes = 0; nsizes < sizeof(default_sizes)/sizeof(default_sizes[0]); nsizes++)
+            sizes[nsizes] = default_sizes[nsizes];
+    }
+
+    for(d = 0; d < BENCH_DISTRIBUTIONS; d++) enabled[d] = argc <= 2;
+    if(argc > 2){
+        snprintf(distributions_buffer, sizeof(distributions_buffer), "%s", argv[2]);
+        for(token = strtok(distributions_buffer, ","); token; token = strtok(NULL, ",")){
+            for(d = 0; d < BENCH_DISTRIBUTIONS && strcmp(token, bench_distribution_names[d]); d++);
+            if(d == BENCH_DISTRIBUTIONS){
+                fprintf(stderr, "unknown distribution %s\n", token);
+                return EXIT_FAILURE;
+            }
+            enabled[d] = true;
+        }
+    }
+
+    bench_perf_init();
+    printf("distribution,hash,size,op,ops,ns_per_op,p50_ns,p90_ns,p99_ns,p999_ns,"
+           "peak_rss_kb,cache_misses_per_op,cache_references_per_op\n");
+    for(i = 0; i < nsizes; i++)
+        for(d = 0; d < BENCH_DISTRIBUTIONS; d++)
+            if(enabled[d]) bench_run((enum bench_distribution)d, hash_name, hash_func, filter_bits, sizes[i]);
+    return 0;
+}
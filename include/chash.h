@@ -0,0 +1,203 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef C_HASH_CHASH_H
+#define C_HASH_CHASH_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Header only, type specialized hashtable generator.
+ *
+ *     CHASH_DECLARE(u64map, uint64_t, double, chash_hash_uint64, chash_equal)
+ *
+ * defines struct u64map and static inline u64map_init / _free / _get /
+ * _put / _delete / _size. Keys and values are stored by value in flat
+ * arrays (open addressing, linear probing) and hash_fn / eq_fn are called
+ * directly, so the compiler can inline the whole lookup. hash_fn takes a
+ * key_t and returns a well mixed uint64_t, eq_fn takes two key_t and may be
+ * a macro.
+ *
+ * Iterate with
+ *
+ *     for(i = 0; i < map.capacity; i++)
+ *         if(u64map_exists(&map, i)) use(map.keys[i], map.vals[i]);
+ */
+
+/* Modify at your own risk */
+
+    #define CHASH_MIN_CAPACITY                  (8)
+
+    /* Grow once 3/4 of the slots are used (items + tombstones) */
+    #define CHASH_MAX_LOAD_NUM                  (3)
+    #define CHASH_MAX_LOAD_DEN                  (4)
+
+    #define CHASH_CTRL_EMPTY                    ((uint8_t)0x00)
+    #define CHASH_CTRL_DELETED                  ((uint8_t)0x01)
+    #define CHASH_CTRL_FULL                     ((uint8_t)0x80)
+
+    #define chash_insufficient_memory_error()   \
+        do{                                     \
+         fprintf(stderr,"Insufficient memory.\n");\
+         exit(EXIT_FAILURE);                    \
+        }while(0)
+
+/*                                  */
+
+static inline uint64_t chash_hash_uint64(uint64_t key){
+    key ^= key >> 30;
+    key *= 0xbf58476d1ce4e5b9ULL;
+    key ^= key >> 27;
+    key *= 0x94d049bb133111ebULL;
+    key ^= key >> 31;
+    return key;
+}
+
+static inline uint64_t chash_hash_uint32(uint32_t key){
+    return chash_hash_uint64(key);
+}
+
+#define chash_equal(key1, key2)                 ((key1) == (key2))
+
+/* Full slots keep the low 7 hash bits in their control byte */
+#define chash_ctrl(hash)                        (CHASH_CTRL_FULL | (uint8_t)((hash) & 0x7f))
+
+#define CHASH_DECLARE(name, key_t, val_t, hash_fn, eq_fn)                                       \
+                                                                                                \
+struct name{                                                                                    \
+    size_t                      capacity,items,tombstones;                                      \
+    uint8_t *                   ctrl;                                                           \
+    key_t *                     keys;                                                           \
+    val_t *                     vals;                                                           \
+};                                                                                              \
+                                                                                                \
+static inline void name##_init(struct name * _table){                                          \
+    _table->capacity = _table->items = _table->tombstones = 0;                                  \
+    _table->ctrl = NULL;                                                                        \
+    _table->keys = NULL;                                                                        \
+    _table->vals = NULL;                                                                        \
+}                                                                                               \
+                                                                                                \
+static inline void name##_free(struct name * _table){                                           \
+    free(_table->ctrl);                                                                         \
+    free(_table->keys);                                                                         \
+    free(_table->vals);                                                                         \
+    name##_init(_table);                                                                        \
+}                                                                                               \
+                                                                                                \
+static inline size_t name##_size(const struct name * _table){                                   \
+    return _table->items;                                                                       \
+}                                                                                               \
+                                                                                                \
+static inline bool name##_exists(const struct name * _table, size_t slot){                      \
+    return _table->ctrl[slot] & CHASH_CTRL_FULL;                                                \
+}                                                                                               \
+                                                                                                \
+/* Slot holding key, or capacity if absent */                                                  \
+static inline size_t name##_find(const struct name * _table, key_t key){                        \
+    size_t mask = _table->capacity - 1, slot;                                                   \
+    uint64_t hash;                                                                              \
+    uint8_t ctrl;                                                                               \
+    if(!_table->capacity) return 0;                                                             \
+    hash = hash_fn(key);                                                                        \
+    for(slot = (size_t)(hash >> 32) & mask; (ctrl = _table->ctrl[slot]) != CHASH_CTRL_EMPTY;    \
+        slot = (slot + 1) & mask){                                                              \
+        if(ctrl == chash_ctrl(hash) && eq_fn(_table->keys[slot], key)) return slot;             \
+    }                                                                                           \
+    return _table->capacity;                                                                    \
+}                                                                                               \
+                                                                                                \
+static inline void name##_resize(struct name * _table, size_t capacity){                        \
+    struct name old = *_table;                                                                  \
+    size_t i, slot, mask = capacity - 1;                                                        \
+    uint64_t hash;                                                                              \
+    if((_table->ctrl = (uint8_t*)calloc(capacity, 1)) == NULL ||                                \
+       (_table->keys = (key_t*)malloc(capacity * sizeof(key_t))) == NULL ||                     \
+       (_table->vals = (val_t*)malloc(capacity * sizeof(val_t))) == NULL)                       \
+        chash_insufficient_memory_error();                                                      \
+    _table->capacity = capacity;                                                                \
+    _table->tombstones = 0;                                                                     \
+    for(i = 0; i < old.capacity; i++){                                                          \
+        if(!(old.ctrl[i] & CHASH_CTRL_FULL)) continue;                                          \
+        hash = hash_fn(old.keys[i]);                                                            \
+        for(slot = (size_t)(hash >> 32) & mask; _table->ctrl[slot] != CHASH_CTRL_EMPTY;         \
+            slot = (slot + 1) & mask);                                                          \
+        _table->ctrl[slot] = chash_ctrl(hash);                                                  \
+        _table->keys[slot] = old.keys[i];                                                       \
+        _table->vals[slot] = old.vals[i];                                                       \
+    }                                                                                           \
+    free(old.ctrl);                                                                             \
+    free(old.keys);                                                                             \
+    free(old.vals);                                                                             \
+}                                                                                               \
+                                                                                                \
+static inline val_t * name##_get(const struct name * _table, key_t key){                        \
+    size_t slot = name##_find(_table, key);                                                     \
+    return slot < _table->capacity ? &_table->vals[slot] : NULL;                                \
+}                                                                                               \
+                                                                                                \
+/* Inserts or overwrites, returns the stored value */                                          \
+static inline val_t * name##_put(struct name * _table, key_t key, val_t val){                   \
+    size_t mask, slot, tombstone;                                                               \
+    uint64_t hash;                                                                              \
+    uint8_t ctrl;                                                                               \
+    if((_table->items + _table->tombstones + 1) * CHASH_MAX_LOAD_DEN >                          \
+       _table->capacity * CHASH_MAX_LOAD_NUM)                                                   \
+        name##_resize(_table, !_table->capacity ? CHASH_MIN_CAPACITY :                          \
+                      _table->items * 2 * CHASH_MAX_LOAD_DEN < _table->capacity * CHASH_MAX_LOAD_NUM ? \
+                      _table->capacity : _table->capacity * 2);                                 \
+    mask = _table->capacity - 1;                                                                \
+    hash = hash_fn(key);                                                                        \
+    tombstone = _table->capacity;                                                               \
+    for(slot = (size_t)(hash >> 32) & mask; (ctrl = _table->ctrl[slot]) != CHASH_CTRL_EMPTY;    \
+        slot = (slot + 1) & mask){                                                              \
+        if(ctrl == CHASH_CTRL_DELETED){                                                         \
+            if(tombstone == _table->capacity) tombstone = slot;                                 \
+        }else if(ctrl == chash_ctrl(hash) && eq_fn(_table->keys[slot], key)){                   \
+            _table->vals[slot] = val;                                                           \
+            return &_table->vals[slot];                                                         \
+        }                                                                                       \
+    }                                                                                           \
+    if(tombstone != _table->capacity){                                                          \
+        slot = tombstone;                                                                       \
+        _table->tombstones--;                                                                   \
+    }                                                                                           \
+    _table->ctrl[slot] = chash_ctrl(hash);                                                      \
+    _table->keys[slot] = key;                                                                   \
+    _table->vals[slot] = val;                                                                   \
+    _table->items++;                                                                            \
+    return &_table->vals[slot];                                                                 \
+}                                                                                               \
+                                                                                                \
+static inline bool name##_delete(struct name * _table, key_t key){                              \
+    size_t slot = name##_find(_table, key);                                                     \
+    if(slot >= _table->capacity) return false;                                                  \
+    /* A slot followed by an empty one can go straight back to empty */                        \
+    if(_table->ctrl[(slot + 1) & (_table->capacity - 1)] == CHASH_CTRL_EMPTY){                  \
+        _table->ctrl[slot] = CHASH_CTRL_EMPTY;                                                  \
+    }else{                                                                                      \
+        _table->ctrl[slot] = CHASH_CTRL_DELETED;                                                \
+        _table->tombstones++;                                                                   \
+    }                                                                                           \
+    _table->items--;                                                                            \
+    return true;                                                                                \
+}
+
+#endif //C_HASH_CHASH_H
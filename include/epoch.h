@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef C_HASH_EPOCH_H
+#define C_HASH_EPOCH_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Process wide epoch based reclamation. Readers bracket every access to
+ * shared nodes with epoch_enter / epoch_exit; writers hand unlinked memory
+ * to epoch_retire instead of freeing it. A retired entry is reclaimed once
+ * every thread that could still hold a reference has left its critical
+ * section, i.e. two global epochs later.
+ *
+ * Entries are intrusive: embed a struct epoch_entry in the retired object
+ * and recover the object in the reclaim callback.
+ */
+
+/* Modify at your own risk */
+
+    /* Retires between two attempts to advance the global epoch */
+    #define EPOCH_ADVANCE_INTERVAL              (64)
+
+/*                                  */
+
+struct epoch_entry{
+    struct epoch_entry *        next;
+    void                        (*reclaim)(struct epoch_entry * entry);
+};
+
+void                        epoch_enter(void);
+void                        epoch_exit(void);
+void                        epoch_retire(struct epoch_entry * entry,
+                                         void (*reclaim)(struct epoch_entry * entry));
+void                        epoch_synchronize(void);
+
+#endif //C_HASH_EPOCH_H
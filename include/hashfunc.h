@@ -37,4 +37,60 @@ hash_type hash_double(void * _double);
 
 hash_type hash_string(void * _string);
 
+/*
+ * Mixing hash family, same signatures as above. Integers go through a
+ * 64 bit finalizer so that every input bit affects every output bit,
+ * floating point numbers are hashed by bit pattern (-0.0 hashes like 0.0,
+ * all NaNs alike) and strings use a wyhash style multiply-fold function
+ * consuming 16 bytes per step (48 for long keys).
+ */
+
+hash_type hash64_int8_t(void * _int8_t);
+hash_type hash64_int16_t(void * _int16_t);
+hash_type hash64_int32_t(void * _int32_t);
+hash_type hash64_int64_t(void * _int64_t);
+
+hash_type hash64_uint8_t(void * _uint8_t);
+hash_type hash64_uint16_t(void * _uint16_t);
+hash_type hash64_uint32_t(void * _uint32_t);
+hash_type hash64_uint64_t(void * _uint64_t);
+
+hash_type hash64_char(void * _char);
+hash_type hash64_short(void * _short);
+hash_type hash64_int(void * _int);
+hash_type hash64_float(void * _float);
+hash_type hash64_double(void * _double);
+
+hash_type hash64_string(void * _string);
+
+/* Length aware variants for binary keys */
+hash_type hash64_bytes(const void * data, size_t length);
+hash_type hash64_bytes_seed(const void * data, size_t length, uint64_t seed);
+hash_type hash64_mix(uint64_t value);
+
+/*
+ * Keyed family, SipHash-2-4 under a 128 bit key. Several times slower
+ * than the mixing family, but colliding inputs can not be precomputed
+ * without the key; see hashtable_set_hardened.
+ */
+
+hash_type siphash_int8_t(void * _int8_t, const uint64_t key[2]);
+hash_type siphash_int16_t(void * _int16_t, const uint64_t key[2]);
+hash_type siphash_int32_t(void * _int32_t, const uint64_t key[2]);
+hash_type siphash_int64_t(void * _int64_t, const uint64_t key[2]);
+
+hash_type siphash_uint8_t(void * _uint8_t, const uint64_t key[2]);
+hash_type siphash_uint16_t(void * _uint16_t, const uint64_t key[2]);
+hash_type siphash_uint32_t(void * _uint32_t, const uint64_t key[2]);
+hash_type siphash_uint64_t(void * _uint64_t, const uint64_t key[2]);
+
+hash_type siphash_char(void * _char, const uint64_t key[2]);
+hash_type siphash_short(void * _short, const uint64_t key[2]);
+hash_type siphash_int(void * _int, const uint64_t key[2]);
+hash_type siphash_float(void * _float, const uint64_t key[2]);
+hash_type siphash_double(void * _double, const uint64_t key[2]);
+
+hash_type siphash_string(void * _string, const uint64_t key[2]);
+hash_type siphash_bytes(const void * data, size_t length, const uint64_t key[2]);
+
 #endif //C_HASH_HASHFUNC_H
@@ -26,11 +26,16 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <math.h>
 #include <time.h>
 
+#include "slab.h"
+#include "hashtable_metrics.h"
+
 /* Modify at your own risk */
 
     typedef uint64_t                            hash_type;
@@ -41,7 +46,46 @@
 
     #define HASHTABLE_MAX_HASH                  (UINT64_MAX)
 
-    #define HASHTABLE_LOAD_FACTOR               1
+    /* Default resize policy, see struct hashtable_policy */
+    #define HASHTABLE_MAX_LOAD                  (1.0f)
+    #define HASHTABLE_MIN_LOAD                  (0.25f)
+    #define HASHTABLE_GROWTH                    (2.0f)
+
+    /* Fewest buckets a chained table shrinks to */
+    #define HASHTABLE_MIN_BUCKETS               (2)
+
+    /* Most entries a table keeps inline before it gets a bucket array */
+    #define HASHTABLE_COMPACT_CAPACITY          (8)
+
+    /* Bits per block of the membership filter, a block is one cache line */
+    #define HASHTABLE_FILTER_BLOCK_BITS         (512)
+
+    /* Empty buckets skipped per migrated bucket during a progressive rehash */
+    #define HASHTABLE_REHASH_EMPTY_VISITS       (10)
+
+    /* Keys whose memory accesses are overlapped by the *_batch functions */
+    #define HASHTABLE_BATCH_GROUP               (16)
+
+    /* Radix partitions per thread in hashtable_build_from_array */
+    #define HASHTABLE_BUILD_PARTITIONS          (4)
+
+    /* Chain length at which a hardened table switches to its keyed hash */
+    #define HASHTABLE_HARDENED_CHAIN            (32)
+
+    /* Reseeds hashtable_optimize tries before keeping the last one */
+    #define HASHTABLE_OPTIMIZE_ROUNDS           (8)
+
+    /* Buckets copied at once when a write hits state shared with a snapshot */
+    #define HASHTABLE_SNAPSHOT_SEGMENT          (256)
+
+    #if defined(__GNUC__)
+    #define hashtable_prefetch(address)         __builtin_prefetch(address)
+    #else
+    #define hashtable_prefetch(address)         ((void)(address))
+    #endif
+
+    /* Low cursor bits holding the seed generation, see hashtable_scan */
+    #define HASHTABLE_SCAN_GENERATION_BITS      (8)
 
     #define HASHTABLE_RANDOM                    (((uint64_t)rand()<<32)+(uint64_t)rand())
     #define HASHTABLE_SRANDOM                   (srand(time(NULL)^(intptr_t)&printf))
@@ -50,26 +94,234 @@
 
 /*                                  */
 
+/*
+ * Bucket of a position (seed * hash) in a table of buckets buckets:
+ * the high word of position * buckets (Lemire's fastrange), so any bucket
+ * count works and every bucket is a contiguous range of positions. For
+ * buckets = 2^k this is the top k bits of position.
+ */
+static inline hash_type hashtable_bucket_of(hash_type position,
+                                            hash_type buckets){
+#if defined(__SIZEOF_INT128__)
+    return (hash_type)(((unsigned __int128)position * buckets) >> 64);
+#else
+    uint64_t low = (position & 0xffffffff) * (buckets & 0xffffffff);
+    uint64_t cross1 = (position >> 32) * (buckets & 0xffffffff);
+    uint64_t cross2 = (position & 0xffffffff) * (buckets >> 32);
+    uint64_t middle = (low >> 32) + (cross1 & 0xffffffff) + (cross2 & 0xffffffff);
+    return (position >> 32) * (buckets >> 32) + (cross1 >> 32) + (cross2 >> 32) + (middle >> 32);
+#endif
+}
+
+/*
+ * hash caches hash_func(data), so resizes never touch the data again. value
+ * belongs to the map API below and stays NULL for plain inserts.
+ */
 struct hashtable_bucket{
     void *                      data;
+    void *                      value;
     struct hashtable_bucket *   next;
+    hash_type                   hash;
+};
+
+/*
+ * Where bucket nodes come from. HASHTABLE_ALLOCATOR_MALLOC (or passing NULL)
+ * allocates every node on its own; HASHTABLE_ALLOCATOR_SLAB carves nodes out
+ * of a per table slab pool, optionally backed by a caller supplied arena
+ * (see slab.h), and releases whole slabs in hashtable_free.
+ */
+enum hashtable_allocator_kind{
+    HASHTABLE_ALLOCATOR_MALLOC,
+    HASHTABLE_ALLOCATOR_SLAB
+};
+
+struct hashtable_allocator{
+    enum hashtable_allocator_kind   kind;
+    size_t                          nodes_per_slab;
+    void *                          (*arena_alloc)(void * arena, size_t size);
+    void                            (*arena_free)(void * arena, void * block);
+    void *                          arena;
+};
+
+/*
+ * Blocked Bloom filter over the cached hashes, see hashtable_set_filter.
+ * blocks holds 1<<block_exponent cache line sized blocks, every key sets
+ * hashes bits of a single block. Deletes cannot clear bits, stale counts
+ * the deletes since the filter was last built.
+ */
+struct hashtable_filter{
+    uint64_t *                  blocks;
+    uint8_t                     block_exponent,hashes;
+    hash_type                   stale;
+};
+
+struct hashtable_compact_entry{
+    void *                      data;
+    void *                      value;
+    hash_type                   hash;
+};
+
+/*
+ * Per table resize policy (hashtable_set_policy). An insert that finds
+ * items >= max_load * buckets first grows the table growth times, a delete
+ * that leaves items < min_load * buckets shrinks it back to a load of
+ * max_load / growth. Requiring min_load * growth < max_load means neither
+ * resize can immediately trigger the other (hysteresis); min_load 0 never
+ * shrinks.
+ */
+struct hashtable_policy{
+    float                       max_load,min_load,growth;
+};
+
+/*
+ * Cache mode (hashtable_set_cache). The table keeps at most max_items
+ * entries and max_bytes bytes (0 leaves a bound out); an entry is charged
+ * for its node plus entry_size(data, value) if entry_size is not NULL,
+ * at insert and again when hashtable_upsert replaces its value.
+ *
+ * Eviction is CLOCK: every node carries a referenced bit, set by every
+ * lookup that finds the entry, so a hit costs one store and no relinking.
+ * An insert that exceeds a bound moves the hand over the buckets, clearing
+ * set bits and evicting entries whose bit is already clear (destroy(data)
+ * is called if not NULL) until the table is back within bounds. New
+ * entries start clear, so entries never looked up again go first, but
+ * the entry being added always stays. hits, misses and evictions are
+ * counted whether HASHTABLE_METRICS is defined or not.
+ */
+struct hashtable_cache{
+    hash_type                   max_items;
+    size_t                      max_bytes;
+    size_t                      (*entry_size)(void * data, void * value);
+    void                        (*destroy)(void * data);
+    uint64_t                    hits,misses,evictions;
+    size_t                      bytes;
+    hash_type                   hand;
+};
+
+/* Node of a cache mode table, starts with the plain node */
+struct hashtable_cache_bucket{
+    struct hashtable_bucket     bucket;
+    size_t                      bytes;
+    bool                        referenced;
 };
 
+/*
+ * HASHTABLE_SNAPSHOT_SEGMENT buckets handed over to snapshots: heads as
+ * they were, and the chains hanging off them, which no longer change.
+ * refs counts the snapshots plus the table while it still shares them.
+ */
+struct hashtable_segment{
+    _Atomic(hash_type)          refs;
+    struct hashtable_segment *  next;
+    struct hashtable_bucket *   heads[HASHTABLE_SNAPSHOT_SEGMENT];
+};
+
+/*
+ * State a table only needs once it has a bucket array or a setting other
+ * than the defaults: allocated on first use, so a plain compact table has
+ * none (ext is NULL). A chained table always has one.
+ *
+ * generation counts seed changes, so scan cursors can detect them.
+ * shrink_at is the item count the policy shrinks at.
+ *
+ * filter and old_filter follow table and old_table through a progressive
+ * rehash: old_filter answers queries until the migration is complete.
+ *
+ * shared[s] is set while segment s of table is shared with snapshots:
+ * table still holds the same heads, so reads do not care, but the nodes
+ * belong to the segment and the first write copies them back into table
+ * (or takes them back if no snapshot is left). During a progressive rehash
+ * old_shared does the same for old_table. shared_segments counts the set
+ * entries of either array. Segments the table gave up wait in retired
+ * until their last snapshot is freed.
+ */
+struct hashtable_extension{
+    hash_type                   generation;
+    struct hashtable_policy     policy;
+    uint8_t                     filter_bits_per_key;
+    hash_type                   shrink_at;
+    hash_type                   old_buckets,rehash_index,rehash_steps;
+    struct hashtable_filter     filter,old_filter;
+    struct hashtable_segment ** shared,** old_shared;
+    struct hashtable_segment *  retired;
+    hash_type                   shared_segments;
+    struct slab_pool *          pool;
+    struct hashtable_cache *    cache;
+    hash_type                   (*keyed_hash_func)(void * data, const uint64_t key[2]);
+    uint64_t                    hash_key[2];
+    bool                        keyed;
+    HASHTABLE_METRICS_ONLY(
+    struct hashtable_metrics    metrics;)
+};
+
+/*
+ * grow_at is the item count the policy grows at, or for a compact table
+ * its capacity.
+ *
+ * A table created for at most HASHTABLE_COMPACT_CAPACITY entries starts
+ * out compact: buckets is 0, there is no bucket array and no
+ * node allocation, the entries live unordered in compact[0..items) and are
+ * searched linearly (comparing the cached hash first). Only the requested
+ * number of entries is allocated (HASHTABLE_COMPACT_BYTES), and compact
+ * shares its storage with table and old_table, so a compact table is a
+ * single allocation of a few words. The insert that would exceed the
+ * capacity promotes the table to the chained layout for good.
+ */
 struct hashtable{
     hash_type                   items,seed;
-    uint8_t                     bucket_size_exponent;
-    struct hashtable_bucket **  table;
+    hash_type                   buckets,grow_at;
     hash_type                   (*hash_func)(void * data);
     bool                        (*equal_func)(void * data1, void * data2);
+    struct hashtable_extension * ext;
+    union{
+        struct{
+            struct hashtable_bucket **  table;
+            struct hashtable_bucket **  old_table;
+        };
+        struct hashtable_compact_entry  compact[HASHTABLE_COMPACT_CAPACITY];
+    };
 };
 
+/* Bytes of a compact table with room for capacity entries */
+#define HASHTABLE_COMPACT_BYTES(capacity) \
+    (offsetof(struct hashtable, compact) + (capacity) * sizeof(struct hashtable_compact_entry))
+
 typedef struct hashtable hashtable;
 
+/*
+ * Read-only point in time view of a table, see hashtable_snapshot. A
+ * compact table's entries are copied into compact.
+ */
+struct hashtable_snapshot{
+    struct hashtable_segment ** segments;
+    hash_type                   items,seed,buckets;
+    hash_type                   (*hash_func)(void * data);
+    hash_type                   (*keyed_hash_func)(void * data, const uint64_t key[2]);
+    uint64_t                    hash_key[2];
+    bool                        keyed;
+    bool                        (*equal_func)(void * data1, void * data2);
+    struct hashtable_compact_entry compact[HASHTABLE_COMPACT_CAPACITY];
+};
+
 struct hashtable *          hashtable_init(hash_type (*hash_func)(void * data),
                                            bool (*equal_func)(void * data1,void * data2));
 struct hashtable *          hashtable_init_size(hash_type (*hash_func)(void * data),
                                                 bool (*equal_func)(void * data1,void * data2),
-                                                hash_type init_size);
+                                                hash_type init_size,
+                                                const struct hashtable_allocator * allocator);
+/*
+ * Builds a table holding keys[0..n), sized once for n. Keys are hashed on
+ * nthreads threads, radix partitioned by destination bucket and linked in
+ * by one thread per disjoint bucket range, without locks. All n nodes come
+ * from one contiguous block of the table's slab pool (the result always
+ * uses HASHTABLE_ALLOCATOR_SLAB). Like hashtable_insert, duplicates in keys
+ * are not merged.
+ */
+struct hashtable *          hashtable_build_from_array(hash_type (*hash_func)(void * data),
+                                                       bool (*equal_func)(void * data1,void * data2),
+                                                       void ** keys,
+                                                       size_t n,
+                                                       unsigned nthreads);
 void                        hashtable_insert(struct hashtable * _hashtable,
                                              void * data);
 void *                      hashtable_query(struct hashtable * _hashtable,
@@ -77,8 +329,168 @@ void *                      hashtable_query(struct hashtable * _hashtable,
 void                        hashtable_delete(struct hashtable * _hashtable,
                                              void * data,
                                              void (*destroy)(void* data));
+/*
+ * Map API: data is the key, each entry carries a separate value. All of
+ * these hash the key once and walk its chain once, and never add a second
+ * entry for a key already present (hashtable_insert does not check).
+ *
+ *   hashtable_get                  value stored for key, NULL if absent
+ *   hashtable_upsert               stores value for key, returns the value
+ *                                  it replaced (NULL if key was new)
+ *   hashtable_get_or_insert        slot holding key's value, adding key
+ *                                  with a NULL value if absent; *inserted
+ *                                  (if not NULL) tells which happened. The
+ *                                  slot is valid until the next operation
+ *                                  that modifies the table
+ *   hashtable_remove_and_return    unlinks key and returns the stored key
+ *                                  (NULL if absent), its value goes to
+ *                                  *value (if not NULL); nothing is
+ *                                  destroyed
+ */
+void *                      hashtable_get(struct hashtable * _hashtable,
+                                          void * key);
+void *                      hashtable_upsert(struct hashtable * _hashtable,
+                                             void * key,
+                                             void * value);
+void **                     hashtable_get_or_insert(struct hashtable * _hashtable,
+                                                    void * key,
+                                                    bool * inserted);
+void *                      hashtable_remove_and_return(struct hashtable * _hashtable,
+                                                        void * key,
+                                                        void ** value);
+/*
+ * Iteration, in bucket order. A bucket is a contiguous range of the
+ * position seed * hash (see hashtable_bucket_of), and resizes
+ * keep the seed, so growing splits a bucket's range and shrinking merges
+ * ranges without reordering anything. This is what reverse-binary cursors
+ * achieve in tables indexed by the low hash bits.
+ *
+ *   hashtable_scan             start with cursor 0, call again with the
+ *                              returned cursor until it returns 0. Every
+ *                              call visits one bucket (the head of the
+ *                              next one too if the bucket count is not a
+ *                              power of two) and calls callback for its
+ *                              entries. The table may be modified
+ *                              (and resized) between calls; entries present
+ *                              for the whole scan are reported exactly
+ *                              once. Only hashtable_optimize reseeds, after
+ *                              which the scan starts over and entries may
+ *                              be reported twice. callback must not modify
+ *                              the table
+ *   hashtable_for_each_parallel
+ *                              splits the buckets into nthreads ranges and
+ *                              walks each range on its own thread (in the
+ *                              caller for nthreads <= 1). callback runs
+ *                              concurrently and must not modify the table
+ */
+hash_type                   hashtable_scan(struct hashtable * _hashtable,
+                                           hash_type cursor,
+                                           void (*callback)(void * data, void * value, void * context),
+                                           void * context);
+void                        hashtable_for_each_parallel(struct hashtable * _hashtable,
+                                                        unsigned nthreads,
+                                                        void (*callback)(void * data, void * value, void * context),
+                                                        void * context);
+void                        hashtable_query_batch(struct hashtable * _hashtable,
+                                                  void ** keys,
+                                                  size_t n,
+                                                  void ** results);
+void                        hashtable_insert_batch(struct hashtable * _hashtable,
+                                                   void ** keys,
+                                                   size_t n);
+void                        hashtable_delete_batch(struct hashtable * _hashtable,
+                                                   void ** keys,
+                                                   size_t n,
+                                                   void (*destroy)(void* data));
+/* O(1) snapshot of the hashtable_metrics.h counters, false if compiled out */
+bool                        hashtable_get_metrics(struct hashtable * _hashtable,
+                                                  struct hashtable_metrics * metrics);
 void                        hashtable_stats(struct hashtable * _hashtable);
 void                        hashtable_print(struct hashtable * _hashtable);
 void                        hashtable_optimize(struct hashtable * _hashtable);
+/*
+ * Progressive rehash: with buckets_per_step > 0 a resize only allocates
+ * the new bucket array, and every insert, delete, get_or_insert, upsert,
+ * remove, query and get then migrates up to buckets_per_step buckets of
+ * the old one (the batch functions one step per key), until it is empty.
+ * Lookups look in both arrays meanwhile. 0 finishes a pending migration
+ * and goes back to resizing all at once.
+ */
+void                        hashtable_set_incremental_rehash(struct hashtable * _hashtable,
+                                                             hash_type buckets_per_step);
+/*
+ * Puts a blocked Bloom filter of bits_per_key bits per bucket in front of
+ * the bucket array (0 removes it), so most lookups of absent keys are
+ * answered from one cache line. Inserts add to it, resizes rebuild it, and
+ * it is rebuilt once the deletes since the last build reach half the
+ * bucket count. Compact tables do not use it. hashtable_stats reports its
+ * estimated false-positive rate.
+ */
+void                        hashtable_set_filter(struct hashtable * _hashtable,
+                                                 unsigned bits_per_key);
+/*
+ * Sizing. hashtable_set_policy returns false (and changes nothing) unless
+ * max_load > 0, growth > 1 and 0 <= min_load * growth < max_load.
+ * hashtable_reserve makes room for n entries at max_load at once, so
+ * inserting up to n entries does not resize; hashtable_shrink_to_fit
+ * resizes to the fewest buckets that hold the current entries at
+ * max_load. Both finish a pending progressive rehash first; neither turns
+ * a chained table compact again.
+ */
+bool                        hashtable_set_policy(struct hashtable * _hashtable,
+                                                 const struct hashtable_policy * policy);
+void                        hashtable_reserve(struct hashtable * _hashtable,
+                                              hash_type n);
+void                        hashtable_shrink_to_fit(struct hashtable * _hashtable);
+/*
+ * Hardened mode, against keys crafted to collide (HashDoS). The seed
+ * cannot separate keys whose hash_func values are equal, so an insert that
+ * finds HASHTABLE_HARDENED_CHAIN entries in its bucket switches the table
+ * for good to keyed_hash_func (e.g. the siphash_* family of hashfunc.h)
+ * under a fresh random key, rehashing every entry once. Until then
+ * hash_func is used as usual and only inserts pay, for walking the chain.
+ * NULL disarms it, a table that already switched goes back to hash_func.
+ */
+void                        hashtable_set_hardened(struct hashtable * _hashtable,
+                                                   hash_type (*keyed_hash_func)(void * data, const uint64_t key[2]));
+/*
+ * Turns cache mode on with the bounds and callbacks of cache (its counters
+ * are ignored) or, for NULL, off. Only an empty table no snapshot still
+ * shares nodes with can switch, since cache mode nodes are larger; returns
+ * false otherwise. table->ext->cache then holds the live counters.
+ */
+bool                        hashtable_set_cache(struct hashtable * _hashtable,
+                                                const struct hashtable_cache * cache);
+/*
+ * Snapshots. hashtable_snapshot returns a consistent view of the table as
+ * it is now without copying any node: the chains are handed over to the
+ * snapshot a segment of HASHTABLE_SNAPSHOT_SEGMENT buckets at a time, and
+ * the table copies a segment back when a write first touches it. Segments
+ * are counted by reference, so one never written since the previous
+ * snapshot is shared by both, and taking a snapshot costs O(segments) plus
+ * copying the heads of the segments written since. Resizes and reseeding
+ * rebuild the table from the shared segments, copying only the nodes a
+ * snapshot still holds; rekeying rewrites every node and copies them all.
+ * A pending progressive rehash is finished first.
+ *
+ * Snapshots are immutable, so hashtable_snapshot_query, _get and
+ * _for_each may run on other threads while the table keeps changing;
+ * hashtable_snapshot_free may be called from any thread too. Memory of
+ * released snapshots is given back by the table's thread, the next time
+ * it snapshots, writes or is freed. Keys and values are not copied, the
+ * caller keeps them alive for as long as a snapshot can reach them. All
+ * snapshots must be freed before their table.
+ */
+struct hashtable_snapshot * hashtable_snapshot(struct hashtable * _hashtable);
+void *                      hashtable_snapshot_query(struct hashtable_snapshot * snapshot,
+                                                     void * data);
+void *                      hashtable_snapshot_get(struct hashtable_snapshot * snapshot,
+                                                   void * key);
+void                        hashtable_snapshot_for_each(struct hashtable_snapshot * snapshot,
+                                                        void (*callback)(void * data, void * value, void * context),
+                                                        void * context);
+void                        hashtable_snapshot_free(struct hashtable_snapshot * snapshot);
+void                        hashtable_free(struct hashtable * _hashtable,
+                                           void (*destroy)(void* data));
 
 #endif
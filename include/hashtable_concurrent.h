@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HASHTABLE_CONCURRENT_H
+#define HASHTABLE_CONCURRENT_H
+
+#include <stdatomic.h>
+#include <pthread.h>
+
+#include "hashtable.h"
+#include "epoch.h"
+
+/*
+ * Thread safe chained hashtable.
+ *
+ * Writers lock one of 2^HASHTABLE_CONCURRENT_STRIPE_EXPONENT stripes,
+ * chosen by the top bits of the seeded hash, so a stripe always covers the
+ * same slice of the hash space whatever the bucket count. Readers take no
+ * lock: chain heads and next pointers are loaded atomically and unlinked
+ * nodes are reclaimed through epoch.h, so hashtable_concurrent_query never
+ * waits on a writer.
+ *
+ * Growing is cooperative: the thread crossing the load factor installs a
+ * bigger bucket array, then stripes are migrated one at a time, under
+ * their lock, by whichever writer touches or claims them. Migrated buckets
+ * are replaced by a forwarding marker that sends readers to the new array.
+ * The table never shrinks.
+ */
+
+/* Modify at your own risk */
+
+    #define HASHTABLE_CONCURRENT_STRIPE_EXPONENT    (6)
+
+    #define HASHTABLE_CONCURRENT_LOAD_FACTOR        1
+
+    /* Stripes a writer migrates on top of its own while a resize is pending */
+    #define HASHTABLE_CONCURRENT_HELP_STRIPES       (1)
+
+    #define HASHTABLE_CONCURRENT_CACHE_LINE         (64)
+
+/*                                  */
+
+struct hashtable_concurrent_bucket{
+    void *                                          data;
+    _Atomic(struct hashtable_concurrent_bucket *)   next;
+    hash_type                                       hash;
+    struct epoch_entry                              retired;
+    void                                            (*destroy)(void* data);
+};
+
+struct hashtable_concurrent_array{
+    struct epoch_entry                              retired;
+    uint8_t                                         bucket_size_exponent;
+    _Atomic(struct hashtable_concurrent_array *)    next;
+    _Atomic hash_type                               migrate_cursor,migrated;
+    uint8_t *                                       stripe_migrated;
+    _Atomic(struct hashtable_concurrent_bucket *)   table[];
+};
+
+struct hashtable_concurrent_stripe{
+    _Alignas(HASHTABLE_CONCURRENT_CACHE_LINE) pthread_mutex_t   lock;
+};
+
+/* hashtable_metrics.h counters, bumped with relaxed atomics */
+struct hashtable_concurrent_metrics{
+    _Atomic uint64_t                                lookups,hits,misses;
+    _Atomic uint64_t                                inserts,deletes;
+    _Atomic uint64_t                                probe_lengths[HASHTABLE_METRICS_PROBE_LENGTHS];
+    _Atomic uint64_t                                resizes,resize_nanoseconds;
+};
+
+struct hashtable_concurrent{
+    _Atomic(struct hashtable_concurrent_array *)    current;
+    _Alignas(HASHTABLE_CONCURRENT_CACHE_LINE) _Atomic hash_type items;
+    hash_type                                       seed;
+    struct hashtable_concurrent_stripe *            stripes;
+    hash_type                                       (*hash_func)(void * data);
+    bool                                            (*equal_func)(void * data1, void * data2);
+    HASHTABLE_METRICS_ONLY(
+    _Alignas(HASHTABLE_CONCURRENT_CACHE_LINE) struct hashtable_concurrent_metrics metrics;)
+};
+
+typedef struct hashtable_concurrent hashtable_concurrent;
+
+struct hashtable_concurrent *   hashtable_concurrent_init(hash_type (*hash_func)(void * data),
+                                                          bool (*equal_func)(void * data1,void * data2));
+struct hashtable_concurrent *   hashtable_concurrent_init_size(hash_type (*hash_func)(void * data),
+                                                               bool (*equal_func)(void * data1,void * data2),
+                                                               hash_type init_size);
+void                            hashtable_concurrent_insert(struct hashtable_concurrent * _hashtable,
+                                                            void * data);
+void *                          hashtable_concurrent_query(struct hashtable_concurrent * _hashtable,
+                                                           void * data);
+void                            hashtable_concurrent_delete(struct hashtable_concurrent * _hashtable,
+                                                            void * data,
+                                                            void (*destroy)(void* data));
+bool                            hashtable_concurrent_get_metrics(struct hashtable_concurrent * _hashtable,
+                                                                 struct hashtable_metrics * metrics);
+void                            hashtable_concurrent_stats(struct hashtable_concurrent * _hashtable);
+void                            hashtable_concurrent_free(struct hashtable_concurrent * _hashtable,
+                                                          void (*destroy)(void* data));
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef HASHTABLE_FILE_H
+#define HASHTABLE_FILE_H
+
+#include "hashtable.h"
+
+/*
+ * Persistent, memory mapped hashtables.
+ *
+ * hashtable_save writes a table to a position independent file: a header
+ * (seed, bucket count, item count), one 64 bit offset per bucket
+ * and the entries, each chain stored contiguously. Every entry carries its
+ * cached hash, the offset of the next entry in its chain, the key blob
+ * (data_size(data) bytes copied from data) and, if value_size is not NULL,
+ * the value blob (value_size(value) bytes copied from the map value, see
+ * hashtable_upsert).
+ *
+ * hashtable_file_open maps such a file read only and answers queries
+ * (hashtable_file_query for the key, hashtable_file_get for the value)
+ * straight from the mapping, without deserializing anything; returned
+ * pointers point into the mapping and stay valid until
+ * hashtable_file_close. Any number of processes can map the same file and
+ * share its page cache. Only deterministic hash functions (all of
+ * hashfunc.h) can be used, since the stored hashes are compared against
+ * hash_func in the reading process.
+ *
+ * The format uses native byte order; save and open return -1 / NULL with
+ * errno set on I/O errors or a malformed file. Offsets are checked against
+ * the mapping, the chain heads once by open and every further hop by the
+ * lookup taking it; a corrupt chain makes query and get return NULL with
+ * errno set to EINVAL.
+ */
+
+/* Modify at your own risk */
+
+    #define HASHTABLE_FILE_MAGIC                "CHASHTB1"
+
+    #define HASHTABLE_FILE_VERSION              (2)
+
+/*                                  */
+
+struct hashtable_file_header{
+    char                        magic[8];
+    uint32_t                    version;
+    uint32_t                    reserved;
+    uint64_t                    seed,buckets,items,table_offset,file_size;
+};
+
+struct hashtable_file_entry{
+    uint64_t                    next,hash,key_length,value_length;
+    /* key bytes, padded to 8, then value bytes */
+};
+
+struct hashtable_file{
+    const uint8_t *             base;
+    size_t                      length;
+    const uint64_t *            table;
+    hash_type                   items,seed,buckets;
+    hash_type                   (*hash_func)(void * data);
+    bool                        (*equal_func)(void * data1, void * data2);
+};
+
+int                         hashtable_save(struct hashtable * _hashtable,
+                                           const char * path,
+                                           size_t (*data_size)(void * data),
+                                           size_t (*value_size)(void * value));
+struct hashtable_file *     hashtable_file_open(const char * path,
+                                                hash_type (*hash_func)(void * data),
+                                                bool (*equal_func)(void * data1,void * data2));
+void *                      hashtable_file_query(struct hashtable_file * _file,
+                                                 void * data);
+const void *                hashtable_file_get(struct hashtable_file * _file,
+                                               void * data,
+                                               size_t * length);
+void                        hashtable_file_close(struct hashtable_file * _file);
+
+#endif
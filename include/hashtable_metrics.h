@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef C_HASH_HASHTABLE_METRICS_H
+#define C_HASH_HASHTABLE_METRICS_H
+
+#include <stdint.h>
+#include <time.h>
+
+/*
+ * Opt-in runtime metrics. Building the library (and everything including
+ * its headers) with HASHTABLE_METRICS defined makes the tables maintain
+ * the counters below on every operation; without it the counters and the
+ * code updating them do not exist, and hashtable_get_metrics /
+ * hashtable_concurrent_get_metrics return false.
+ *
+ *   lookups, hits, misses      key searches (queries and the search part of
+ *                              deletes and map operations)
+ *   inserts, deletes           nodes added and removed
+ *   probe_lengths[i]           searches that compared i nodes, the last
+ *                              slot counts all longer searches
+ *   filter_rejects             searches answered by the membership filter
+ *   filter_false_positives     searches the filter let through that missed
+ *   resizes                    bucket array grows and shrinks
+ *   resize_nanoseconds         time spent moving chains, progressive and
+ *                              cooperative migrations included
+ *   allocated_bytes            table header, bucket arrays and live nodes
+ *   items, buckets             current size
+ *
+ * Reading them is O(1), nothing is rescanned.
+ */
+
+/* Modify at your own risk */
+
+    #define HASHTABLE_METRICS_PROBE_LENGTHS     (16)
+
+/*                                  */
+
+struct hashtable_metrics{
+    uint64_t                    lookups,hits,misses;
+    uint64_t                    inserts,deletes;
+    uint64_t                    probe_lengths[HASHTABLE_METRICS_PROBE_LENGTHS];
+    uint64_t                    filter_rejects,filter_false_positives;
+    uint64_t                    resizes,resize_nanoseconds;
+    uint64_t                    allocated_bytes;
+    uint64_t                    items,buckets;
+};
+
+#if defined(HASHTABLE_METRICS)
+
+#define HASHTABLE_METRICS_ONLY(...)             __VA_ARGS__
+
+static inline unsigned hashtable_metrics_probe_slot(uint64_t probes){
+    return probes < HASHTABLE_METRICS_PROBE_LENGTHS - 1 ? (unsigned)probes : HASHTABLE_METRICS_PROBE_LENGTHS - 1;
+}
+
+static inline uint64_t hashtable_metrics_now(void){
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+#else
+
+#define HASHTABLE_METRICS_ONLY(...)
+
+#endif
+
+#endif //C_HASH_HASHTABLE_METRICS_H
@@ -0,0 +1,70 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef C_HASH_SLAB_H
+#define C_HASH_SLAB_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Fixed size object pool. Objects are carved out of large slabs and
+ * recycled through an intrusive free list, so allocating or releasing a
+ * node is a couple of pointer moves. Slabs are only returned as a whole,
+ * by slab_pool_destroy. slab_pool_alloc_bulk hands out count contiguous
+ * objects in a slab of their own; each of them can later be passed to
+ * slab_pool_free like any other object.
+ *
+ * Slabs come from malloc unless an arena is supplied, in which case
+ * arena_alloc(arena, size) provides them and arena_free(arena, slab), if
+ * not NULL, gives them back.
+ */
+
+/* Modify at your own risk */
+
+    #define SLAB_DEFAULT_OBJECTS                (1024)
+
+/*                                  */
+
+struct slab{
+    struct slab *               next;
+};
+
+struct slab_pool{
+    size_t                      object_size,objects_per_slab;
+    void *                      free_list;
+    char *                      bump,* bump_end;
+    struct slab *               slabs;
+    void *                      (*arena_alloc)(void * arena, size_t size);
+    void                        (*arena_free)(void * arena, void * block);
+    void *                      arena;
+};
+
+void                        slab_pool_init(struct slab_pool * pool,
+                                           size_t object_size,
+                                           size_t objects_per_slab,
+                                           void * (*arena_alloc)(void * arena, size_t size),
+                                           void (*arena_free)(void * arena, void * block),
+                                           void * arena);
+void *                      slab_pool_alloc(struct slab_pool * pool);
+void *                      slab_pool_alloc_bulk(struct slab_pool * pool,
+                                                 size_t count);
+void                        slab_pool_free(struct slab_pool * pool,
+                                           void * object);
+void                        slab_pool_destroy(struct slab_pool * pool);
+
+#endif //C_HASH_SLAB_H
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef C_HASH_STRTABLE_H
+#define C_HASH_STRTABLE_H
+
+#include "hashtable.h"
+
+/*
+ * Chained map from byte string keys to values. Unlike a struct hashtable
+ * with hash_string / equal_string, the table copies every key into its
+ * node together with its length: keys shorter than STRTABLE_INLINE_KEY
+ * bytes are stored inline, longer ones keep their first STRTABLE_PREFIX
+ * bytes inline and the whole key in a separate allocation. A probe
+ * compares the cached hash, the length and then the inline bytes, so
+ * misses and short keys never leave the node, and the key memory can be
+ * reused by the caller as soon as a call returns.
+ *
+ * Keys are (key, length) pairs and may contain NUL bytes; the copies are
+ * NUL terminated, so strtable_for_each hands out C strings for C string
+ * keys.
+ *
+ *   strtable_upsert                stores value for key, returns the value
+ *                                  it replaced (NULL if key was new)
+ *   strtable_get_or_insert         slot holding key's value, adding key
+ *                                  with a NULL value if absent; *inserted
+ *                                  (if not NULL) tells which happened
+ *   strtable_remove                unlinks key, its value goes to *value
+ *                                  (if not NULL); false if key was absent
+ */
+
+/* Modify at your own risk */
+
+    /* Inline key bytes per node, including the terminating NUL */
+    #define STRTABLE_INLINE_KEY                 (24)
+
+    /* Bytes of a long key kept next to the pointer to the whole key */
+    #define STRTABLE_PREFIX                     (STRTABLE_INLINE_KEY - sizeof(char*))
+
+    #define STRTABLE_DEFAULT_INIT_SIZE          (16)
+
+    /* Tables double past one item per bucket and halve below one per eight */
+    #define STRTABLE_MIN_BUCKETS                (16)
+
+/*                                  */
+
+struct strtable_bucket{
+    struct strtable_bucket *    next;
+    hash_type                   hash;
+    void *                      value;
+    size_t                      length;
+    union{
+        char                    bytes[STRTABLE_INLINE_KEY];
+        struct{
+            char                prefix[STRTABLE_PREFIX];
+            char *              heap;
+        };
+    }                           key;
+};
+
+struct strtable{
+    hash_type                   items,seed;
+    hash_type                   buckets;
+    struct strtable_bucket **   table;
+};
+
+typedef struct strtable strtable;
+
+/* The stored copy of a node's key */
+static inline const char * strtable_key(const struct strtable_bucket * bucket){
+    return bucket->length < STRTABLE_INLINE_KEY ? bucket->key.bytes : bucket->key.heap;
+}
+
+struct strtable *           strtable_init(void);
+struct strtable *           strtable_init_size(hash_type init_size);
+void *                      strtable_get(struct strtable * _strtable,
+                                         const char * key,
+                                         size_t length);
+void *                      strtable_upsert(struct strtable * _strtable,
+                                            const char * key,
+                                            size_t length,
+                                            void * value);
+void **                     strtable_get_or_insert(struct strtable * _strtable,
+                                                   const char * key,
+                                                   size_t length,
+                                                   bool * inserted);
+bool                        strtable_remove(struct strtable * _strtable,
+                                            const char * key,
+                                            size_t length,
+                                            void ** value);
+void                        strtable_for_each(struct strtable * _strtable,
+                                              void (*callback)(const char * key, size_t length, void * value, void * context),
+                                              void * context);
+void                        strtable_free(struct strtable * _strtable,
+                                          void (*destroy)(void* value));
+
+#endif //C_HASH_STRTABLE_H
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef SWISSTABLE_H
+#define SWISSTABLE_H
+
+#include "hashtable.h"
+
+/*
+ * Open addressing table with the same interface as struct hashtable.
+ * Entries live in one flat slot array; a parallel array of control bytes
+ * holds a 7 bit fragment of each entry's hash (or EMPTY / DELETED), and
+ * lookups compare a whole group of 16 control bytes at once before ever
+ * touching a slot.
+ */
+
+/* Modify at your own risk */
+
+    #define SWISSTABLE_GROUP_WIDTH              (16)
+
+    #define SWISSTABLE_DEFAULT_INIT_SIZE        (32)
+
+    /* Grow when more than 7/8 of the slots are in use (items + tombstones) */
+    #define SWISSTABLE_MAX_LOAD_NUM             (7)
+    #define SWISSTABLE_MAX_LOAD_DEN             (8)
+
+    #define SWISSTABLE_CTRL_EMPTY               ((int8_t)-128)
+    #define SWISSTABLE_CTRL_DELETED             ((int8_t)-2)
+
+/*                                  */
+
+struct swisstable{
+    hash_type                   items,tombstones,seed;
+    uint8_t                     group_size_exponent;
+    int8_t *                    ctrl;
+    void **                     slots;
+    hash_type                   (*hash_func)(void * data);
+    bool                        (*equal_func)(void * data1, void * data2);
+};
+
+typedef struct swisstable swisstable;
+
+struct swisstable *         swisstable_init(hash_type (*hash_func)(void * data),
+                                            bool (*equal_func)(void * data1,void * data2));
+struct swisstable *         swisstable_init_size(hash_type (*hash_func)(void * data),
+                                                 bool (*equal_func)(void * data1,void * data2),
+                                                 hash_type init_size);
+void                        swisstable_insert(struct swisstable * _swisstable,
+                                              void * data);
+void *                      swisstable_query(struct swisstable * _swisstable,
+                                             void * data);
+void                        swisstable_delete(struct swisstable * _swisstable,
+                                              void * data,
+                                              void (*destroy)(void* data));
+void                        swisstable_stats(struct swisstable * _swisstable);
+void                        swisstable_free(struct swisstable * _swisstable,
+                                            void (*destroy)(void* data));
+
+#endif
@@ -0,0 +1,218 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/epoch.h"
+#include "../include/hashtable.h"
+
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sched.h>
+
+/*
+ * Every thread owns a record announcing the epoch it entered at (state is
+ * epoch << 1 | active). The global epoch only moves from e to e+1 once no
+ * active record is still in an older epoch, so memory retired while the
+ * global epoch was e is unreachable once it reaches e+2. Each record keeps
+ * three limbo lists, indexed by retire epoch modulo 3. Lists still
+ * pending when their thread exits become orphans, reclaimed by whichever
+ * thread reclaims next.
+ */
+
+#define EPOCH_ACTIVE    ((uint64_t)1)
+
+struct epoch_record{
+    _Atomic uint64_t            state;
+    atomic_bool                 in_use;
+    unsigned                    nesting,retired;
+    uint64_t                    limbo_epoch[3];
+    struct epoch_entry *        limbo[3];
+    struct epoch_record *       next;
+};
+
+static _Atomic uint64_t                 epoch_global = 0;
+static _Atomic(struct epoch_record *)   epoch_records = NULL;
+static _Thread_local struct epoch_record * epoch_local = NULL;
+static pthread_key_t                    epoch_key;
+static pthread_once_t                   epoch_key_once = PTHREAD_ONCE_INIT;
+
+struct epoch_orphan{
+    uint64_t                    epoch;
+    struct epoch_entry *        list;
+    struct epoch_orphan *       next;
+};
+
+/* Guarded by epoch_orphans_lock, epoch_orphans_pending lets reclaims skip it */
+static struct epoch_orphan *            epoch_orphans = NULL;
+static atomic_bool                      epoch_orphans_pending = false;
+static pthread_mutex_t                  epoch_orphans_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static void epoch_reclaim(struct epoch_record * record,
+                          uint64_t global);
+
+/* Records are never freed, an exiting thread leaves its record for the next one */
+static void epoch_thread_exit(void * _record){
+    struct epoch_record * record = (struct epoch_record*)_record;
+    struct epoch_orphan * orphan;
+    int i;
+
+    epoch_reclaim(record, atomic_load(&epoch_global));
+    pthread_mutex_lock(&epoch_orphans_lock);
+    for(i = 0; i < 3; i++){
+        if(!record->limbo[i]) continue;
+        if((orphan = (struct epoch_orphan*)malloc(sizeof(struct epoch_orphan))) == NULL)
+            hashtable_insufficient_memory_error();
+        orphan->epoch = record->limbo_epoch[i];
+        orphan->list = record->limbo[i];
+        orphan->next = epoch_orphans;
+        epoch_orphans = orphan;
+        record->limbo[i] = NULL;
+    }
+    atomic_store(&epoch_orphans_pending, epoch_orphans != NULL);
+    pthread_mutex_unlock(&epoch_orphans_lock);
+    record->nesting = 0;
+    atomic_store_explicit(&record->state, 0, memory_order_release);
+    atomic_store_explicit(&record->in_use, false, memory_order_release);
+}
+
+static void epoch_key_init(void){
+    pthread_key_create(&epoch_key, epoch_thread_exit);
+}
+
+static struct epoch_record * epoch_record_get(void){
+    struct epoch_record * record, * head;
+    bool expected;
+
+    if((record = epoch_local)) return record;
+    pthread_once(&epoch_key_once, epoch_key_init);
+
+    for(record = atomic_load(&epoch_records); record; record = record->next){
+        expected = false;
+        if(atomic_compare_exchange_strong(&record->in_use, &expected, true)) break;
+    }
+    if(!record){
+        if((record = (struct epoch_record*)calloc(1, sizeof(struct epoch_record))) == NULL)
+            hashtable_insufficient_memory_error();
+        atomic_init(&record->in_use, true);
+        head = atomic_load(&epoch_records);
+        do record->next = head;
+        while(!atomic_compare_exchange_weak(&epoch_records, &head, record));
+    }
+    pthread_setspecific(epoch_key, record);
+    return epoch_local = record;
+}
+
+static void epoch_reclaim_list(struct epoch_entry * entry){
+    struct epoch_entry * next;
+    for(; entry; entry = next){
+        next = entry->next;
+        entry->reclaim(entry);
+    }
+}
+
+/* Unlinks the orphans that are safe at global under the lock, reclaims them outside of it */
+static void epoch_reclaim_orphans(uint64_t global){
+    struct epoch_orphan ** link, * orphan, * ripe = NULL;
+
+    if(!atomic_load(&epoch_orphans_pending)) return;
+    if(pthread_mutex_trylock(&epoch_orphans_lock)) return;
+    for(link = &epoch_orphans; (orphan = *link);){
+        if(orphan->epoch + 2 <= global){
+            *link = orphan->next;
+            orphan->next = ripe;
+            ripe = orphan;
+        }else{
+            link = &orphan->next;
+        }
+    }
+    atomic_store(&epoch_orphans_pending, epoch_orphans != NULL);
+    pthread_mutex_unlock(&epoch_orphans_lock);
+    for(; (orphan = ripe); free(orphan)){
+        ripe = orphan->next;
+        epoch_reclaim_list(orphan->list);
+    }
+}
+
+static void epoch_reclaim(struct epoch_record * record,
+                          uint64_t global){
+    struct epoch_entry * list;
+    int i;
+    for(i = 0; i < 3; i++){
+        if(record->limbo[i] && record->limbo_epoch[i] + 2 <= global){
+            list = record->limbo[i];
+            record->limbo[i] = NULL;
+            epoch_reclaim_list(list);
+        }
+    }
+    epoch_reclaim_orphans(global);
+}
+
+static bool epoch_try_advance(void){
+    uint64_t global = atomic_load(&epoch_global), state;
+    struct epoch_record * record;
+
+    for(record = atomic_load(&epoch_records); record; record = record->next){
+        state = atomic_load(&record->state);
+        if((state & EPOCH_ACTIVE) && (state >> 1) != global) return false;
+    }
+    return atomic_compare_exchange_strong(&epoch_global, &global, global + 1);
+}
+
+void epoch_enter(void){
+    struct epoch_record * record = epoch_record_get();
+    if(record->nesting++) return;
+    atomic_store(&record->state, (atomic_load(&epoch_global) << 1) | EPOCH_ACTIVE);
+    atomic_thread_fence(memory_order_seq_cst);
+}
+
+void epoch_exit(void){
+    struct epoch_record * record = epoch_local;
+    if(--record->nesting == 0)
+        atomic_store_explicit(&record->state, 0, memory_order_release);
+}
+
+void epoch_retire(struct epoch_entry * entry,
+                  void (*reclaim)(struct epoch_entry * entry)){
+    struct epoch_record * record = epoch_record_get();
+    uint64_t global = atomic_load(&epoch_global);
+    int i = (int)(global % 3);
+    struct epoch_entry * list;
+
+    /* A list from three or more epochs ago is already safe */
+    if(record->limbo[i] && record->limbo_epoch[i] != global){
+        list = record->limbo[i];
+        record->limbo[i] = NULL;
+        epoch_reclaim_list(list);
+    }
+    entry->reclaim = reclaim;
+    entry->next = record->limbo[i];
+    record->limbo[i] = entry;
+    record->limbo_epoch[i] = global;
+
+    if(++record->retired % EPOCH_ADVANCE_INTERVAL == 0){
+        epoch_try_advance();
+        epoch_reclaim(record, atomic_load(&epoch_global));
+    }
+}
+
+/* Waits until everything this thread retired so far is reclaimed. Must not be called inside epoch_enter / epoch_exit. */
+void epoch_synchronize(void){
+    struct epoch_record * record = epoch_record_get();
+    uint64_t target = atomic_load(&epoch_global) + 2;
+
+    while(atomic_load(&epoch_global) < target)
+        if(!epoch_try_advance()) sched_yield();
+    epoch_reclaim(record, atomic_load(&epoch_global));
+}
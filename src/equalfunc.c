@@ -33,29 +33,29 @@ bool equal_double(void * data1, void * data2){
 }
 
 bool equal_int8_t(void * data1, void * data2){
-    return *(int8_t*)data1 = *(int8_t*)data2;
+    return *(int8_t*)data1 == *(int8_t*)data2;
 }
 bool equal_int16_t(void * data1, void * data2){
-    return *(int16_t*)data1 = *(int16_t*)data2;
+    return *(int16_t*)data1 == *(int16_t*)data2;
 }
 bool equal_int32_t(void * data1, void * data2){
-    return *(int32_t*)data1 = *(int32_t*)data2;
+    return *(int32_t*)data1 == *(int32_t*)data2;
 }
 bool equal_int64_t(void * data1, void * data2){
-    return *(int64_t*)data1 = *(int64_t*)data2;
+    return *(int64_t*)data1 == *(int64_t*)data2;
 }
 
 bool equal_uint8_t(void * data1, void * data2){
-    return *(uint8_t*)data1 = *(uint8_t*)data2;
+    return *(uint8_t*)data1 == *(uint8_t*)data2;
 }
 bool equal_uint16_t(void * data1, void * data2){
-    return *(uint16_t*)data1 = *(uint16_t*)data2;
+    return *(uint16_t*)data1 == *(uint16_t*)data2;
 }
 bool equal_uint32_t(void * data1, void * data2){
-    return *(uint32_t*)data1 = *(uint32_t*)data2;
+    return *(uint32_t*)data1 == *(uint32_t*)data2;
 }
 bool equal_uint64_t(void * data1, void * data2){
-    return *(uint64_t*)data1 = *(uint64_t*)data2;
+    return *(uint64_t*)data1 == *(uint64_t*)data2;
 }
 
 bool equal_string(void * data1, void * data2){
@@ -68,4 +68,253 @@ hash_type hash_string(void * _string){
         hash = hash * 33 + c;
 
     return (hash_type)hash;
-}
\ No newline at end of file
+}
+
+/* splitmix64 finalizer */
+hash_type hash64_mix(uint64_t value){
+    value ^= value >> 30;
+    value *= 0xbf58476d1ce4e5b9ULL;
+    value ^= value >> 27;
+    value *= 0x94d049bb133111ebULL;
+    value ^= value >> 31;
+    return value;
+}
+
+hash_type hash64_int8_t(void * _int8_t){
+    return hash64_mix((uint64_t)*(int8_t*)_int8_t);
+}
+hash_type hash64_int16_t(void * _int16_t){
+    return hash64_mix((uint64_t)*(int16_t*)_int16_t);
+}
+hash_type hash64_int32_t(void * _int32_t){
+    return hash64_mix((uint64_t)*(int32_t*)_int32_t);
+}
+hash_type hash64_int64_t(void * _int64_t){
+    return hash64_mix((uint64_t)*(int64_t*)_int64_t);
+}
+
+hash_type hash64_uint8_t(void * _uint8_t){
+    return hash64_mix(*(uint8_t*)_uint8_t);
+}
+hash_type hash64_uint16_t(void * _uint16_t){
+    return hash64_mix(*(uint16_t*)_uint16_t);
+}
+hash_type hash64_uint32_t(void * _uint32_t){
+    return hash64_mix(*(uint32_t*)_uint32_t);
+}
+hash_type hash64_uint64_t(void * _uint64_t){
+    return hash64_mix(*(uint64_t*)_uint64_t);
+}
+
+hash_type hash64_char(void * _char){
+    return hash64_mix((uint64_t)*(char*)_char);
+}
+hash_type hash64_short(void * _short){
+    return hash64_mix((uint64_t)*(short*)_short);
+}
+hash_type hash64_int(void * _int){
+    return hash64_mix((uint64_t)*(int*)_int);
+}
+
+/* equal_float treats -0.0 and 0.0 as equal, so they have to hash alike */
+hash_type hash64_float(void * _float){
+    float value = *(float*)_float;
+    uint32_t bits;
+    if(value == 0) value = 0;
+    else if(value != value) value = NAN;
+    memcpy(&bits, &value, sizeof(bits));
+    return hash64_mix(bits);
+}
+hash_type hash64_double(void * _double){
+    double value = *(double*)_double;
+    uint64_t bits;
+    if(value == 0) value = 0;
+    else if(value != value) value = NAN;
+    memcpy(&bits, &value, sizeof(bits));
+    return hash64_mix(bits);
+}
+
+/*
+ * Bytes hash after wyhash (public domain, Wang Yi): each step multiplies
+ * two 64 bit lanes into a 128 bit product and folds it back to 64 bits.
+ */
+
+#define HASH64_P0   0xa0761d6478bd642fULL
+#define HASH64_P1   0xe7037ed1a0b428dbULL
+#define HASH64_P2   0x8ebc6af09c88c6e3ULL
+#define HASH64_P3   0x589965cc75374cc3ULL
+
+static inline uint64_t hash64_mum(uint64_t a, uint64_t b){
+#if defined(__SIZEOF_INT128__)
+    __uint128_t product = (__uint128_t)a * b;
+    return (uint64_t)product ^ (uint64_t)(product >> 64);
+#else
+    uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + (rm0 << 32), c = t < rl, lo;
+    lo = t + (rm1 << 32);
+    c += lo < t;
+    return lo ^ (rh + (rm0 >> 32) + (rm1 >> 32) + c);
+#endif
+}
+
+static inline uint64_t hash64_read64(const uint8_t * p){
+    uint64_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+static inline uint64_t hash64_read32(const uint8_t * p){
+    uint32_t value;
+    memcpy(&value, p, sizeof(value));
+    return value;
+}
+
+hash_type hash64_bytes_seed(const void * data, size_t length, uint64_t seed){
+    const uint8_t * p = (const uint8_t*)data;
+    uint64_t a, b, see1, see2;
+    size_t i = length;
+
+    seed ^= hash64_mum(seed ^ HASH64_P0, HASH64_P1);
+    if(length <= 16){
+        if(length >= 4){
+            a = (hash64_read32(p) << 32) | hash64_read32(p + ((length >> 3) << 2));
+            b = (hash64_read32(p + length - 4) << 32) | hash64_read32(p + length - 4 - ((length >> 3) << 2));
+        }else if(length > 0){
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[length >> 1] << 8) | p[length - 1];
+            b = 0;
+        }else{
+            a = b = 0;
+        }
+    }else{
+        if(i > 48){
+            see1 = see2 = seed;
+            do{
+                seed = hash64_mum(hash64_read64(p) ^ HASH64_P1, hash64_read64(p + 8) ^ seed);
+                see1 = hash64_mum(hash64_read64(p + 16) ^ HASH64_P2, hash64_read64(p + 24) ^ see1);
+                see2 = hash64_mum(hash64_read64(p + 32) ^ HASH64_P3, hash64_read64(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            }while(i > 48);
+            seed ^= see1 ^ see2;
+        }
+        while(i > 16){
+            seed = hash64_mum(hash64_read64(p) ^ HASH64_P1, hash64_read64(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+        a = hash64_read64(p + i - 16);
+        b = hash64_read64(p + i - 8);
+    }
+    return hash64_mum(HASH64_P1 ^ length, hash64_mum(a ^ HASH64_P1, b ^ seed));
+}
+
+hash_type hash64_bytes(const void * data, size_t length){
+    return hash64_bytes_seed(data, length, 0);
+}
+
+hash_type hash64_string(void * _string){
+    return hash64_bytes(_string, strlen((char*)_string));
+}
+/*
+ * SipHash-2-4 (Aumasson, Bernstein): keyed, so inputs colliding under
+ * every seed of the functions above can not be found without the key.
+ */
+
+#define SIPHASH_ROTL(x, b)  (((x) << (b)) | ((x) >> (64 - (b))))
+
+#define SIPHASH_ROUND(v0, v1, v2, v3)                                       \
+    do{                                                                     \
+        v0 += v1; v1 = SIPHASH_ROTL(v1, 13); v1 ^= v0; v0 = SIPHASH_ROTL(v0, 32); \
+        v2 += v3; v3 = SIPHASH_ROTL(v3, 16); v3 ^= v2;                      \
+        v0 += v3; v3 = SIPHASH_ROTL(v3, 21); v3 ^= v0;                      \
+        v2 += v1; v1 = SIPHASH_ROTL(v1, 17); v1 ^= v2; v2 = SIPHASH_ROTL(v2, 32); \
+    }while(0)
+
+hash_type siphash_bytes(const void * data, size_t length, const uint64_t key[2]){
+    const uint8_t * p = (const uint8_t*)data, * end = p + (length & ~(size_t)7);
+    uint64_t v0 = key[0] ^ 0x736f6d6570736575ULL, v1 = key[1] ^ 0x646f72616e646f6dULL;
+    uint64_t v2 = key[0] ^ 0x6c7967656e657261ULL, v3 = key[1] ^ 0x7465646279746573ULL;
+    uint64_t m, last = (uint64_t)length << 56;
+    size_t i;
+
+    for(; p != end; p += 8){
+        m = hash64_read64(p);
+        v3 ^= m;
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        SIPHASH_ROUND(v0, v1, v2, v3);
+        v0 ^= m;
+    }
+    for(i = 0; i < (length & 7); i++)
+        last |= (uint64_t)p[i] << (8 * i);
+    v3 ^= last;
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    SIPHASH_ROUND(v0, v1, v2, v3);
+    v0 ^= last;
+    v2 ^= 0xff;
+    for(i = 0; i < 4; i++)
+        SIPHASH_ROUND(v0, v1, v2, v3);
+    return v0 ^ v1 ^ v2 ^ v3;
+}
+
+/* Integers are hashed as 64 bit words, so equal values of any width collide */
+static inline hash_type siphash_word(uint64_t value, const uint64_t key[2]){
+    return siphash_bytes(&value, sizeof(value), key);
+}
+
+hash_type siphash_int8_t(void * _int8_t, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(int8_t*)_int8_t, key);
+}
+hash_type siphash_int16_t(void * _int16_t, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(int16_t*)_int16_t, key);
+}
+hash_type siphash_int32_t(void * _int32_t, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(int32_t*)_int32_t, key);
+}
+hash_type siphash_int64_t(void * _int64_t, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(int64_t*)_int64_t, key);
+}
+
+hash_type siphash_uint8_t(void * _uint8_t, const uint64_t key[2]){
+    return siphash_word(*(uint8_t*)_uint8_t, key);
+}
+hash_type siphash_uint16_t(void * _uint16_t, const uint64_t key[2]){
+    return siphash_word(*(uint16_t*)_uint16_t, key);
+}
+hash_type siphash_uint32_t(void * _uint32_t, const uint64_t key[2]){
+    return siphash_word(*(uint32_t*)_uint32_t, key);
+}
+hash_type siphash_uint64_t(void * _uint64_t, const uint64_t key[2]){
+    return siphash_word(*(uint64_t*)_uint64_t, key);
+}
+
+hash_type siphash_char(void * _char, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(char*)_char, key);
+}
+hash_type siphash_short(void * _short, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(short*)_short, key);
+}
+hash_type siphash_int(void * _int, const uint64_t key[2]){
+    return siphash_word((uint64_t)*(int*)_int, key);
+}
+
+/* Same normalization as hash64_float / hash64_double */
+hash_type siphash_float(void * _float, const uint64_t key[2]){
+    float value = *(float*)_float;
+    uint32_t bits;
+    if(value == 0) value = 0;
+    else if(value != value) value = NAN;
+    memcpy(&bits, &value, sizeof(bits));
+    return siphash_word(bits, key);
+}
+hash_type siphash_double(void * _double, const uint64_t key[2]){
+    double value = *(double*)_double;
+    uint64_t bits;
+    if(value == 0) value = 0;
+    else if(value != value) value = NAN;
+    memcpy(&bits, &value, sizeof(bits));
+    return siphash_word(bits, key);
+}
+
+hash_type siphash_string(void * _string, const uint64_t key[2]){
+    return siphash_bytes(_string, strlen((char*)_string), key);
+}
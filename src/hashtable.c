@@ -15,33 +15,160 @@
  */
 #include "../include/hashtable.h"
 
-static inline struct hashtable_bucket * hashtable_new_bucket(void * data,
+#include <pthread.h>
+
+/* One compact entry covers the chained fields it shares its storage with */
+_Static_assert(sizeof(struct hashtable_compact_entry) >=
+               offsetof(struct hashtable, old_table) + sizeof(struct hashtable_bucket **) - offsetof(struct hashtable, compact),
+               "a compact table of capacity 1 cannot be promoted in place");
+
+/* The extension of a table, allocated with the default policy on first use */
+static struct hashtable_extension * hashtable_extension(struct hashtable * _hashtable){
+    if(_hashtable->ext) return _hashtable->ext;
+    if((_hashtable->ext = (struct hashtable_extension*)calloc(1, sizeof(struct hashtable_extension))) == NULL)
+        hashtable_insufficient_memory_error();
+    _hashtable->ext->policy.max_load   = HASHTABLE_MAX_LOAD;
+    _hashtable->ext->policy.min_load   = HASHTABLE_MIN_LOAD;
+    _hashtable->ext->policy.growth     = HASHTABLE_GROWTH;
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.allocated_bytes = sizeof(struct hashtable_extension);)
+    return _hashtable->ext;
+}
+
+/* Cache mode nodes carry the CLOCK state behind the plain node */
+static inline size_t hashtable_node_size(struct hashtable * _hashtable){
+    return _hashtable->ext->cache ? sizeof(struct hashtable_cache_bucket) : sizeof(struct hashtable_bucket);
+}
+
+static inline struct hashtable_bucket * hashtable_new_bucket(struct hashtable * _hashtable,
+                                                             void * data,
+                                                             hash_type hash,
                                                              struct hashtable_bucket * next){
     struct hashtable_bucket * new_bucket;
-    if ((new_bucket = (struct hashtable_bucket*)malloc(sizeof(struct hashtable_bucket))) == NULL)
+    if (_hashtable->ext->pool)
+        new_bucket = (struct hashtable_bucket*)slab_pool_alloc(_hashtable->ext->pool);
+    else if ((new_bucket = (struct hashtable_bucket*)malloc(hashtable_node_size(_hashtable))) == NULL)
         hashtable_insufficient_memory_error();
     new_bucket->data = data;
+    new_bucket->value = NULL;
+    new_bucket->hash = hash;
     new_bucket->next = next;
+    if (_hashtable->ext->cache){
+        ((struct hashtable_cache_bucket*)new_bucket)->bytes = 0;
+        ((struct hashtable_cache_bucket*)new_bucket)->referenced = false;
+    }
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.allocated_bytes += hashtable_node_size(_hashtable);)
     return new_bucket;
 }
 
-static inline hash_type hashtable_hash(hashtable * _hashtable,
+static inline void hashtable_free_bucket(struct hashtable * _hashtable,
+                                         struct hashtable_bucket * bucket){
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.allocated_bytes -= hashtable_node_size(_hashtable);)
+    if (_hashtable->ext->pool) slab_pool_free(_hashtable->ext->pool, bucket);
+    else free(bucket);
+}
+
+/* Murmur3 finalizer, hash_func values can be weak (identity) in their low bits */
+static inline uint64_t hashtable_filter_mix(hash_type hash) {
+    hash ^= hash >> 33;
+    hash *= 0xff51afd7ed558ccdULL;
+    hash ^= hash >> 33;
+    hash *= 0xc4ceb9fe1a85ec53ULL;
+    return hash ^ (hash >> 33);
+}
+
+/*
+ * The top bits of the mixed hash select the block, the low bits give the
+ * start and the (odd) stride of the hashes bit positions inside it.
+ */
+static inline void hashtable_filter_add(struct hashtable_filter * filter,
+                                        hash_type hash) {
+    uint64_t mixed = hashtable_filter_mix(hash);
+    uint64_t * block = filter->blocks + (mixed >> (HASHTABLE_WORD_SIZE - filter->block_exponent)) * (HASHTABLE_FILTER_BLOCK_BITS / 64);
+    unsigned i, bit = mixed % HASHTABLE_FILTER_BLOCK_BITS, step = (mixed / HASHTABLE_FILTER_BLOCK_BITS) % HASHTABLE_FILTER_BLOCK_BITS | 1;
+
+    for(i = 0; i < filter->hashes; i++, bit = (bit + step) % HASHTABLE_FILTER_BLOCK_BITS)
+        block[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static inline bool hashtable_filter_contains(const struct hashtable_filter * filter,
+                                             hash_type hash) {
+    uint64_t mixed = hashtable_filter_mix(hash);
+    const uint64_t * block = filter->blocks + (mixed >> (HASHTABLE_WORD_SIZE - filter->block_exponent)) * (HASHTABLE_FILTER_BLOCK_BITS / 64);
+    unsigned i, bit = mixed % HASHTABLE_FILTER_BLOCK_BITS, step = (mixed / HASHTABLE_FILTER_BLOCK_BITS) % HASHTABLE_FILTER_BLOCK_BITS | 1;
+
+    for(i = 0; i < filter->hashes; i++, bit = (bit + step) % HASHTABLE_FILTER_BLOCK_BITS)
+        if(!(block[bit / 64] & (uint64_t)1 << (bit % 64))) return false;
+    return true;
+}
+
+/* An empty filter of bits_per_key bits per bucket, at least two blocks */
+static void hashtable_filter_init(struct hashtable_filter * filter,
+                                  uint8_t bits_per_key,
+                                  hash_type buckets) {
+    hash_type bits = (hash_type)bits_per_key * buckets;
+    size_t size;
+
+    for(filter->block_exponent = 1;
+        ((hash_type)HASHTABLE_FILTER_BLOCK_BITS << filter->block_exponent) < bits;
+        filter->block_exponent++);
+    filter->hashes = (uint8_t)(bits_per_key * 0.693 + 0.5);
+    if(!filter->hashes) filter->hashes = 1;
+    filter->stale = 0;
+    size = (size_t)(HASHTABLE_FILTER_BLOCK_BITS / 8) << filter->block_exponent;
+    if((filter->blocks = (uint64_t*)aligned_alloc(HASHTABLE_FILTER_BLOCK_BITS / 8, size)) == NULL)
+        hashtable_insufficient_memory_error();
+    memset(filter->blocks, 0, size);
+}
+
+static inline bool hashtable_keyed(struct hashtable * _hashtable) {
+    return _hashtable->ext && _hashtable->ext->keyed;
+}
+
+/* Hash of data, keyed once a hardened table has switched */
+static inline hash_type hashtable_hash(struct hashtable * _hashtable,
                                        void * data) {
-    return (hash_type)(_hashtable->seed * _hashtable->hash_func(data)) >> (HASHTABLE_WORD_SIZE - _hashtable->bucket_size_exponent);
+    return hashtable_keyed(_hashtable) ? _hashtable->ext->keyed_hash_func(data, _hashtable->ext->hash_key) : _hashtable->hash_func(data);
+}
+
+/* Bucket of an entry, from the hash cached in its node */
+static inline hash_type hashtable_index(hashtable * _hashtable,
+                                        hash_type hash) {
+    return hashtable_bucket_of(_hashtable->seed * hash, _hashtable->buckets);
+}
+
+/* First position of bucket, the inverse of hashtable_bucket_of */
+static hash_type hashtable_bucket_start(hash_type bucket,
+                                        hash_type buckets) {
+#if defined(__SIZEOF_INT128__)
+    return (hash_type)((((unsigned __int128)bucket << 64) + buckets - 1) / buckets);
+#else
+    hash_type low = 0, high = HASHTABLE_MAX_HASH, middle;
+
+    while(low < high){
+        middle = low + (high - low) / 2;
+        if(hashtable_bucket_of(middle, buckets) < bucket) low = middle + 1;
+        else high = middle;
+    }
+    return low;
+#endif
 }
 
+/*
+ * Moves every node of the first old_buckets buckets to the bucket it maps
+ * to now, in place. Works for any change of bucket count or seed: a node
+ * moved to a bucket not visited yet is already where it belongs then.
+ */
 static void hashtable_rehash(struct hashtable * _hashtable,
-                             uint8_t old_size_exponent) {
+                             hash_type old_buckets) {
     hash_type i,hash;
     struct hashtable_bucket *temp,*prev;
-    _hashtable->seed = HASHTABLE_RANDOM; /* Optional, increases Security*/
 
-    for(i=0;i<1<<old_size_exponent;i++){
+    for(i=0;i<old_buckets;i++){
         for(temp = _hashtable->table[i], prev=NULL;
             temp;
             prev = i==hash?temp:NULL, temp = i==hash?temp->next:_hashtable->table[i])
         {
-            hash=hashtable_hash(_hashtable,temp->data);
+            hash=hashtable_index(_hashtable,temp->hash);
             if(hash!=i){
                 if(prev)prev->next = temp->next;
                 else _hashtable->table[i]=temp->next;
@@ -53,6 +180,97 @@ static void hashtable_rehash(struct hashtable * _hashtable,
     }
 }
 
+/* Frees the retired segments no snapshot refers to anymore, with their nodes */
+static void hashtable_cow_reclaim(struct hashtable * _hashtable) {
+    struct hashtable_segment ** link = &_hashtable->ext->retired, * segment;
+    struct hashtable_bucket * temp, * next;
+    hash_type i;
+
+    while((segment = *link)){
+        if(atomic_load_explicit(&segment->refs, memory_order_acquire)){
+            link = &segment->next;
+            continue;
+        }
+        *link = segment->next;
+        for(i = 0; i < HASHTABLE_SNAPSHOT_SEGMENT; i++)
+            for(temp = segment->heads[i]; temp; temp = next){
+                next = temp->next;
+                hashtable_free_bucket(_hashtable, temp);
+            }
+        free(segment);
+    }
+}
+
+/*
+ * Makes segment of table (buckets buckets, shared entries in *shared)
+ * writable again. Without snapshots left the table takes the nodes back,
+ * otherwise it copies the chains, keeping their order, and retires the
+ * segment.
+ */
+static void hashtable_cow_segment(struct hashtable * _hashtable,
+                                  struct hashtable_bucket ** table,
+                                  hash_type buckets,
+                                  struct hashtable_segment *** shared,
+                                  hash_type index) {
+    struct hashtable_segment * segment = (*shared)[index];
+    struct hashtable_bucket * temp, ** tail;
+    hash_type i, first = index * HASHTABLE_SNAPSHOT_SEGMENT;
+
+    if(atomic_load_explicit(&segment->refs, memory_order_acquire) == 1){
+        free(segment);
+    }else{
+        for(i = first; i < first + HASHTABLE_SNAPSHOT_SEGMENT && i < buckets; i++){
+            for(tail = &table[i], temp = segment->heads[i - first]; temp; temp = temp->next){
+                *tail = hashtable_new_bucket(_hashtable, temp->data, temp->hash, NULL);
+                (*tail)->value = temp->value;
+                if(_hashtable->ext->cache){
+                    ((struct hashtable_cache_bucket*)*tail)->bytes = ((struct hashtable_cache_bucket*)temp)->bytes;
+                    ((struct hashtable_cache_bucket*)*tail)->referenced = ((struct hashtable_cache_bucket*)temp)->referenced;
+                }
+                tail = &(*tail)->next;
+            }
+        }
+        segment->next = _hashtable->ext->retired;
+        _hashtable->ext->retired = segment;
+        atomic_fetch_sub_explicit(&segment->refs, 1, memory_order_acq_rel);
+    }
+    (*shared)[index] = NULL;
+    if(!--_hashtable->ext->shared_segments){
+        free(*shared);
+        *shared = NULL;
+    }
+}
+
+/* Makes bucket of table writable, and frees what snapshots gave back */
+static inline void hashtable_cow_own_bucket(struct hashtable * _hashtable,
+                                            hash_type bucket) {
+    if(_hashtable->ext->retired)
+        hashtable_cow_reclaim(_hashtable);
+    if(_hashtable->ext->shared && _hashtable->ext->shared[bucket / HASHTABLE_SNAPSHOT_SEGMENT])
+        hashtable_cow_segment(_hashtable, _hashtable->table, _hashtable->buckets,
+                              &_hashtable->ext->shared, bucket / HASHTABLE_SNAPSHOT_SEGMENT);
+}
+
+/* Makes bucket of old_table writable, it must not be migrated yet */
+static inline void hashtable_cow_own_old_bucket(struct hashtable * _hashtable,
+                                                hash_type bucket) {
+    if(_hashtable->ext->old_shared && _hashtable->ext->old_shared[bucket / HASHTABLE_SNAPSHOT_SEGMENT])
+        hashtable_cow_segment(_hashtable, _hashtable->old_table, _hashtable->ext->old_buckets,
+                              &_hashtable->ext->old_shared, bucket / HASHTABLE_SNAPSHOT_SEGMENT);
+}
+
+/* Makes every chain the key with hash full can be in writable */
+static inline void hashtable_cow_own(struct hashtable * _hashtable,
+                                     hash_type full) {
+    hash_type bucket;
+
+    hashtable_cow_own_bucket(_hashtable, hashtable_index(_hashtable, full));
+    if(_hashtable->ext->old_shared){
+        bucket = hashtable_bucket_of(_hashtable->seed * full, _hashtable->ext->old_buckets);
+        if(bucket >= _hashtable->ext->rehash_index) hashtable_cow_own_old_bucket(_hashtable, bucket);
+    }
+}
+
 static void* hashtable_realloc_zero(void * pBuffer,
                                     size_t oldSize,
                                     size_t newSize)
@@ -66,51 +284,492 @@ static void* hashtable_realloc_zero(void * pBuffer,
     return pNew;
 }
 
-static void hashtable_expand(struct hashtable * _hashtable) {
+/* Item counts at which the policy grows and shrinks the current bucket count */
+static void hashtable_set_thresholds(struct hashtable * _hashtable) {
+    _hashtable->grow_at = (hash_type)ceil(_hashtable->ext->policy.max_load * (double)_hashtable->buckets);
+    _hashtable->ext->shrink_at = (hash_type)ceil(_hashtable->ext->policy.min_load * (double)_hashtable->buckets);
+    if(!_hashtable->grow_at) _hashtable->grow_at = 1;
+}
+
+/*
+ * Fewest buckets that take items entries before the policy grows them.
+ * This and hashtable_policy_buckets size compact tables for promotion
+ * too, which need their extension from then on anyway.
+ */
+static hash_type hashtable_fit_buckets(struct hashtable * _hashtable,
+                                       hash_type items) {
+    struct hashtable_policy * policy = &hashtable_extension(_hashtable)->policy;
+    hash_type buckets = (hash_type)ceil(items / (double)policy->max_load);
+
+    while((hash_type)ceil(policy->max_load * (double)buckets) < items) buckets++;
+    return buckets < HASHTABLE_MIN_BUCKETS ? HASHTABLE_MIN_BUCKETS : buckets;
+}
+
+/* Buckets for items entries at max_load / growth, the load after a resize */
+static hash_type hashtable_policy_buckets(struct hashtable * _hashtable,
+                                          hash_type items) {
+    struct hashtable_policy * policy = &hashtable_extension(_hashtable)->policy;
+    hash_type buckets = (hash_type)ceil(items * (double)policy->growth / policy->max_load);
+
+    return buckets < HASHTABLE_MIN_BUCKETS ? HASHTABLE_MIN_BUCKETS : buckets;
+}
+
+/*
+ * Progressive rehash: the new bucket array replaces table right away, the
+ * previous one is kept as old_table and drained rehash_steps buckets at a
+ * time by subsequent operations. Buckets of old_table below rehash_index
+ * have already been migrated. The seed is kept for the whole migration so
+ * a bucket in either array can be located from the same hash.
+ */
+static void hashtable_rehash_start(struct hashtable * _hashtable,
+                                   hash_type new_buckets) {
+    _hashtable->old_table            = _hashtable->table;
+    _hashtable->ext->old_buckets          = _hashtable->buckets;
+    _hashtable->ext->old_shared           = _hashtable->ext->shared;
+    _hashtable->ext->shared               = NULL;
+    _hashtable->buckets              = new_buckets;
+    _hashtable->ext->rehash_index         = 0;
+    hashtable_set_thresholds(_hashtable);
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.resizes++;)
+
+    if((_hashtable->table = (struct hashtable_bucket**)calloc(new_buckets,
+                                                              sizeof(struct hashtable_bucket*))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    /* The new filter fills up as the chains move, like the new table */
+    if(_hashtable->ext->filter.blocks){
+        _hashtable->ext->old_filter = _hashtable->ext->filter;
+        hashtable_filter_init(&_hashtable->ext->filter, _hashtable->ext->filter_bits_per_key, new_buckets);
+    }
+}
+
+static void hashtable_rehash_step(struct hashtable * _hashtable,
+                                  hash_type buckets) {
+    hash_type old_size = _hashtable->ext->old_buckets;
+    /* Saturated, hashtable_rehash_finish asks for HASHTABLE_MAX_HASH buckets */
+    hash_type empty_visits = buckets > old_size / HASHTABLE_REHASH_EMPTY_VISITS ?
+                             old_size : buckets * HASHTABLE_REHASH_EMPTY_VISITS;
+    hash_type hash;
+    struct hashtable_bucket *temp,*next;
+    HASHTABLE_METRICS_ONLY(uint64_t start = hashtable_metrics_now();)
+
+    while(buckets && _hashtable->ext->rehash_index < old_size){
+        hashtable_cow_own_old_bucket(_hashtable, _hashtable->ext->rehash_index);
+        temp = _hashtable->old_table[_hashtable->ext->rehash_index];
+        _hashtable->old_table[_hashtable->ext->rehash_index++] = NULL;
+        if(!temp){
+            if(!--empty_visits) break;
+            continue;
+        }
+        for(; temp; temp = next){
+            next = temp->next;
+            hash = hashtable_index(_hashtable,temp->hash);
+            temp->next = _hashtable->table[hash];
+            _hashtable->table[hash] = temp;
+            if(_hashtable->ext->filter.blocks) hashtable_filter_add(&_hashtable->ext->filter, temp->hash);
+        }
+        buckets--;
+    }
+    if(_hashtable->ext->rehash_index == old_size){
+        free(_hashtable->old_table);
+        _hashtable->old_table = NULL;
+        free(_hashtable->ext->old_filter.blocks);
+        _hashtable->ext->old_filter.blocks = NULL;
+    }
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.resize_nanoseconds += hashtable_metrics_now() - start;)
+}
+
+static inline bool hashtable_is_compact(struct hashtable * _hashtable) {
+    return !_hashtable->buckets;
+}
+
+static void hashtable_rehash_finish(struct hashtable * _hashtable) {
+    if(!hashtable_is_compact(_hashtable) && _hashtable->old_table)
+        hashtable_rehash_step(_hashtable, HASHTABLE_MAX_HASH);
+}
+
+/* Refills the filter from scratch, sized for the current bucket count */
+static void hashtable_filter_build(struct hashtable * _hashtable) {
+    hash_type i;
+    struct hashtable_bucket * temp;
+
+    free(_hashtable->ext->filter.blocks);
+    hashtable_filter_init(&_hashtable->ext->filter, _hashtable->ext->filter_bits_per_key, _hashtable->buckets);
+    for(i = 0; i < _hashtable->buckets; i++)
+        for(temp = _hashtable->table[i]; temp; temp = temp->next)
+            hashtable_filter_add(&_hashtable->ext->filter, temp->hash);
+}
+
+/* Every filter a lookup may consult has to know about a new entry */
+static inline void hashtable_filter_insert(struct hashtable * _hashtable,
+                                           hash_type full) {
+    if(_hashtable->ext->filter.blocks) hashtable_filter_add(&_hashtable->ext->filter, full);
+    if(_hashtable->ext->old_filter.blocks) hashtable_filter_add(&_hashtable->ext->old_filter, full);
+}
+
+/*
+ * Moves every entry into new_buckets buckets: progressively (see above)
+ * if asked to, otherwise right away, reallocating the array in place.
+ */
+static void hashtable_resize(struct hashtable * _hashtable,
+                             hash_type new_buckets,
+                             bool progressive) {
     struct hashtable_bucket **safe;
+    hash_type old_buckets = _hashtable->buckets;
+    HASHTABLE_METRICS_ONLY(uint64_t start;)
 
-    _hashtable->bucket_size_exponent++;
-    if((safe =
-                (struct hashtable_bucket**)hashtable_realloc_zero
-                        (_hashtable->table,
-                         sizeof(struct hashtable_bucket*) * (1<<(_hashtable->bucket_size_exponent-1)),
-                         sizeof(struct hashtable_bucket*)*(1<<_hashtable->bucket_size_exponent))
-       )== NULL) hashtable_insufficient_memory_error();
+    if(new_buckets == old_buckets) return;
+    /* Shared nodes cannot be relinked in place, the migration copies them */
+    if(progressive || _hashtable->ext->shared){
+        hashtable_rehash_start(_hashtable, new_buckets);
+        if(!progressive) hashtable_rehash_finish(_hashtable);
+        return;
+    }
+    HASHTABLE_METRICS_ONLY(
+    start = hashtable_metrics_now();
+    _hashtable->ext->metrics.resizes++;)
 
-    _hashtable->table = safe;
-    hashtable_rehash(_hashtable, _hashtable->bucket_size_exponent-1);
+    if(new_buckets > old_buckets){
+        if((safe =
+                    (struct hashtable_bucket**)hashtable_realloc_zero
+                            (_hashtable->table,
+                             sizeof(struct hashtable_bucket*) * old_buckets,
+                             sizeof(struct hashtable_bucket*) * new_buckets)
+           )== NULL) hashtable_insufficient_memory_error();
+        _hashtable->table = safe;
+        _hashtable->buckets = new_buckets;
+        hashtable_rehash(_hashtable, old_buckets);
+    }else{
+        _hashtable->buckets = new_buckets;
+        hashtable_rehash(_hashtable, old_buckets);
+        if((safe =
+                    (struct hashtable_bucket**)hashtable_realloc_zero
+                            (_hashtable->table,
+                             sizeof(struct hashtable_bucket*) * old_buckets,
+                             sizeof(struct hashtable_bucket*) * new_buckets)
+           )== NULL) hashtable_insufficient_memory_error();
+        _hashtable->table = safe;
+    }
+    hashtable_set_thresholds(_hashtable);
+    if(_hashtable->ext->filter.blocks) hashtable_filter_build(_hashtable);
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.resize_nanoseconds += hashtable_metrics_now() - start;)
+}
+
+static void hashtable_expand(struct hashtable * _hashtable) {
+    hash_type buckets = hashtable_policy_buckets(_hashtable, _hashtable->items);
+
+    hashtable_resize(_hashtable, buckets > _hashtable->buckets ? buckets : _hashtable->buckets + 1,
+                     _hashtable->ext->rehash_steps != 0);
 }
 
 static void hashtable_collapse(struct hashtable * _hashtable){
-    struct hashtable_bucket **safe;
+    hash_type buckets = hashtable_policy_buckets(_hashtable, _hashtable->items);
+
+    if(buckets < _hashtable->buckets)
+        hashtable_resize(_hashtable, buckets, _hashtable->ext->rehash_steps != 0);
+}
+
+/* 128 fresh bits for the keyed hash, from the kernel if it has them */
+static void hashtable_random_key(uint64_t key[2]) {
+    FILE * fp;
+    size_t read = 0;
+
+    if((fp = fopen("/dev/urandom", "rb")) != NULL){
+        read = fread(key, sizeof(uint64_t), 2, fp);
+        fclose(fp);
+    }
+    if(read != 2){
+        key[0] = HASHTABLE_RANDOM ^ (uint64_t)time(NULL);
+        key[1] = HASHTABLE_RANDOM ^ (uint64_t)(uintptr_t)key;
+    }
+}
 
-    _hashtable->bucket_size_exponent--;
-    hashtable_rehash(_hashtable, _hashtable->bucket_size_exponent+1);
-    if((safe =
-                (struct hashtable_bucket**)hashtable_realloc_zero
-                        (_hashtable->table,
-                         sizeof(struct hashtable_bucket*) * (1<<(_hashtable->bucket_size_exponent+1)),
-                         sizeof(struct hashtable_bucket*)*(1<<_hashtable->bucket_size_exponent))
-       )== NULL) hashtable_insufficient_memory_error();
+/*
+ * Switches to the keyed hash under a fresh key (or back to hash_func),
+ * recomputing every cached hash, and moves the entries under a new seed.
+ */
+static void hashtable_rekey(struct hashtable * _hashtable,
+                            bool keyed) {
+    struct hashtable_bucket * temp;
+    hash_type i;
+
+    hashtable_rehash_finish(_hashtable);
+    _hashtable->ext->keyed = keyed;
+    if(keyed) hashtable_random_key(_hashtable->ext->hash_key);
+    if(hashtable_is_compact(_hashtable)){
+        for(i = 0; i < _hashtable->items; i++)
+            _hashtable->compact[i].hash = hashtable_hash(_hashtable, _hashtable->compact[i].data);
+        return;
+    }
+    /* Every cached hash changes, so every shared node is copied */
+    for(i = 0; i < _hashtable->buckets; i++){
+        hashtable_cow_own_bucket(_hashtable, i);
+        for(temp = _hashtable->table[i]; temp; temp = temp->next)
+            temp->hash = hashtable_hash(_hashtable, temp->data);
+    }
+    _hashtable->seed = HASHTABLE_RANDOM;
+    _hashtable->ext->generation++;
+    hashtable_rehash(_hashtable, _hashtable->buckets);
+    if(_hashtable->ext->filter.blocks) hashtable_filter_build(_hashtable);
+}
+
+/*
+ * Hardened mode: adding to a chain of HASHTABLE_HARDENED_CHAIN entries
+ * switches the table to its keyed hash. Returns the hash to insert data
+ * with, recomputed if the table switched.
+ */
+static inline hash_type hashtable_harden_check(struct hashtable * _hashtable,
+                                               void * data,
+                                               hash_type full) {
+    struct hashtable_bucket * temp;
+    unsigned length = 0;
 
-    _hashtable->table = safe;
+    if(!_hashtable->ext->keyed_hash_func || _hashtable->ext->keyed) return full;
+    for(temp = _hashtable->table[hashtable_index(_hashtable, full)];
+        temp && length < HASHTABLE_HARDENED_CHAIN;
+        temp = temp->next)
+        length++;
+    if(length < HASHTABLE_HARDENED_CHAIN) return full;
+    hashtable_rekey(_hashtable, true);
+    return hashtable_hash(_hashtable, data);
+}
+
+static inline bool hashtable_cache_over(struct hashtable * _hashtable) {
+    struct hashtable_cache * cache = _hashtable->ext->cache;
+
+    return (cache->max_items && _hashtable->items > cache->max_items) ||
+           (cache->max_bytes && cache->bytes > cache->max_bytes);
+}
+
+/*
+ * CLOCK hand: sweeps the buckets, clearing referenced bits and evicting
+ * entries found clear, until the table is within bounds. keep is never
+ * evicted. The hand stays on a bucket it did not finish. During a
+ * progressive rehash it goes on past table over the buckets of old_table
+ * not migrated yet, so a bounded insert never forces the migration.
+ */
+static void hashtable_cache_evict(struct hashtable * _hashtable,
+                                  struct hashtable_bucket * keep) {
+    struct hashtable_cache * cache = _hashtable->ext->cache;
+    struct hashtable_bucket ** link, * temp;
+    struct hashtable_cache_bucket * node;
+    hash_type old;
+
+    while(hashtable_cache_over(_hashtable) && _hashtable->items > 1){
+        if(cache->hand >= _hashtable->buckets){
+            old = cache->hand - _hashtable->buckets;
+            if(!_hashtable->old_table || old >= _hashtable->ext->old_buckets){
+                cache->hand = 0;
+                continue;
+            }
+            if(old < _hashtable->ext->rehash_index){
+                cache->hand = _hashtable->buckets + _hashtable->ext->rehash_index;
+                continue;
+            }
+            hashtable_cow_own_old_bucket(_hashtable, old);
+            link = &_hashtable->old_table[old];
+        } else {
+            hashtable_cow_own_bucket(_hashtable, cache->hand);
+            link = &_hashtable->table[cache->hand];
+        }
+        while((temp = *link) && hashtable_cache_over(_hashtable)){
+            node = (struct hashtable_cache_bucket*)temp;
+            if(temp == keep || node->referenced){
+                if(temp != keep) node->referenced = false;
+                link = &temp->next;
+                continue;
+            }
+            *link = temp->next;
+            cache->bytes -= node->bytes;
+            cache->evictions++;
+            if(cache->destroy) cache->destroy(temp->data);
+            hashtable_free_bucket(_hashtable, temp);
+            _hashtable->items--;
+            HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.deletes++;)
+            if(_hashtable->ext->filter.blocks) _hashtable->ext->filter.stale++;
+        }
+        if(!temp) cache->hand++;
+    }
+}
+
+/* Charges a new or changed entry to the byte budget, then enforces the bounds */
+static void hashtable_cache_admit(struct hashtable * _hashtable,
+                                  struct hashtable_bucket * bucket) {
+    struct hashtable_cache * cache = _hashtable->ext->cache;
+    struct hashtable_cache_bucket * node = (struct hashtable_cache_bucket*)bucket;
+
+    cache->bytes -= node->bytes;
+    node->bytes = sizeof(struct hashtable_cache_bucket) +
+                  (cache->entry_size ? cache->entry_size(bucket->data, bucket->value) : 0);
+    cache->bytes += node->bytes;
+    if(hashtable_cache_over(_hashtable)) hashtable_cache_evict(_hashtable, bucket);
+}
+
+/* Counts a cache mode lookup, a hit sets the referenced bit */
+static inline void hashtable_cache_lookup(struct hashtable * _hashtable,
+                                          struct hashtable_bucket ** link) {
+    struct hashtable_cache_bucket * node;
+
+    if(!_hashtable->ext->cache) return;
+    if(!link){
+        _hashtable->ext->cache->misses++;
+        return;
+    }
+    _hashtable->ext->cache->hits++;
+    node = (struct hashtable_cache_bucket*)*link;
+    if(!node->referenced) node->referenced = true;
+}
+
+#if defined(HASHTABLE_METRICS)
+static inline void hashtable_record_search(struct hashtable * _hashtable,
+                                           bool hit,
+                                           hash_type probes) {
+    _hashtable->ext->metrics.lookups++;
+    if(hit) _hashtable->ext->metrics.hits++;
+    else _hashtable->ext->metrics.misses++;
+    _hashtable->ext->metrics.probe_lengths[hashtable_metrics_probe_slot(probes)]++;
+}
+
+static inline struct hashtable_bucket ** hashtable_record_lookup(struct hashtable * _hashtable,
+                                                                 struct hashtable_bucket ** link,
+                                                                 hash_type probes) {
+    hashtable_record_search(_hashtable, link != NULL, probes);
+    if(!link && _hashtable->ext->filter.blocks) _hashtable->ext->metrics.filter_false_positives++;
+    return link;
+}
+#else
+    #define hashtable_record_lookup(_hashtable, link, probes)   (link)
+#endif
+
+/*
+ * Returns the link (bucket head or next field) that points at the node
+ * holding data, looking into the not yet migrated part of old_table too.
+ * A filter miss answers without touching the buckets.
+ */
+static struct hashtable_bucket ** hashtable_find(struct hashtable * _hashtable,
+                                                 void * data,
+                                                 hash_type full) {
+    hash_type position = _hashtable->seed * full, hash;
+    struct hashtable_bucket ** link;
+    HASHTABLE_METRICS_ONLY(hash_type probes = 0;)
+
+    if(_hashtable->ext->filter.blocks &&
+       !hashtable_filter_contains(_hashtable->ext->old_filter.blocks ? &_hashtable->ext->old_filter : &_hashtable->ext->filter, full)){
+        HASHTABLE_METRICS_ONLY(
+        hashtable_record_search(_hashtable, false, 0);
+        _hashtable->ext->metrics.filter_rejects++;)
+        return NULL;
+    }
+
+    link = &_hashtable->table[hashtable_bucket_of(position, _hashtable->buckets)];
+    for(; *link; link = &(*link)->next){
+        HASHTABLE_METRICS_ONLY(probes++;)
+        if((*link)->hash == full && _hashtable->equal_func((*link)->data,data))
+            return hashtable_record_lookup(_hashtable, link, probes);
+    }
+
+    if(_hashtable->old_table){
+        hash = hashtable_bucket_of(position, _hashtable->ext->old_buckets);
+        if(hash < _hashtable->ext->rehash_index) return hashtable_record_lookup(_hashtable, NULL, probes);
+        for(link = &_hashtable->old_table[hash]; *link; link = &(*link)->next){
+            HASHTABLE_METRICS_ONLY(probes++;)
+            if((*link)->hash == full && _hashtable->equal_func((*link)->data,data))
+                return hashtable_record_lookup(_hashtable, link, probes);
+        }
+    }
+    return hashtable_record_lookup(_hashtable, NULL, probes);
+}
+
+/*
+ * Link to the node holding exactly data found by hashtable_find, looked up
+ * again after hashtable_cow_own copied its chain. Compares pointers only,
+ * so the search is not counted twice.
+ */
+static struct hashtable_bucket ** hashtable_relink(struct hashtable * _hashtable,
+                                                   void * data,
+                                                   hash_type full) {
+    struct hashtable_bucket ** link = &_hashtable->table[hashtable_index(_hashtable, full)];
+
+    for(; *link; link = &(*link)->next)
+        if((*link)->data == data) return link;
+    if(!_hashtable->old_table) return NULL;
+    link = &_hashtable->old_table[hashtable_bucket_of(_hashtable->seed * full, _hashtable->ext->old_buckets)];
+    for(; *link; link = &(*link)->next)
+        if((*link)->data == data) return link;
+    return NULL;
+}
+
+static struct hashtable_compact_entry * hashtable_compact_find(struct hashtable * _hashtable,
+                                                              void * data,
+                                                              hash_type full) {
+    struct hashtable_compact_entry * entry = _hashtable->compact, * end = entry + _hashtable->items;
+
+    for(; entry < end; entry++)
+        if(entry->hash == full && _hashtable->equal_func(entry->data,data))
+            break;
+    HASHTABLE_METRICS_ONLY(hashtable_record_search(_hashtable, entry < end, entry - _hashtable->compact + (entry < end));)
+    return entry < end ? entry : NULL;
+}
+
+static inline struct hashtable_compact_entry * hashtable_compact_add(struct hashtable * _hashtable,
+                                                                     void * data,
+                                                                     hash_type full) {
+    struct hashtable_compact_entry * entry = &_hashtable->compact[_hashtable->items++];
+
+    entry->data = data;
+    entry->value = NULL;
+    entry->hash = full;
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.inserts++;)
+    return entry;
+}
+
+/*
+ * Moves the inline entries of a compact table into nodes of a bucket
+ * array of the given size. The entries are copied out first, the bucket
+ * array fields overlay them. The chained state of the extension is still
+ * zeroed, a compact table never touches it.
+ */
+static void hashtable_compact_promote(struct hashtable * _hashtable,
+                                      hash_type buckets) {
+    struct hashtable_extension * ext = hashtable_extension(_hashtable);
+    struct hashtable_compact_entry entries[HASHTABLE_COMPACT_CAPACITY];
+    hash_type i, count = _hashtable->items, hash;
+    HASHTABLE_METRICS_ONLY(
+    uint64_t start = hashtable_metrics_now();
+    ext->metrics.resizes++;)
+
+    memcpy(entries, _hashtable->compact, count * sizeof(struct hashtable_compact_entry));
+    _hashtable->buckets = buckets;
+    _hashtable->old_table = NULL;
+    hashtable_set_thresholds(_hashtable);
+    if((_hashtable->table = (struct hashtable_bucket**)calloc(buckets,
+                                                              sizeof(struct hashtable_bucket*))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    for(i = 0; i < count; i++){
+        hash = hashtable_index(_hashtable, entries[i].hash);
+        _hashtable->table[hash] = hashtable_new_bucket(_hashtable, entries[i].data, entries[i].hash, _hashtable->table[hash]);
+        _hashtable->table[hash]->value = entries[i].value;
+    }
+    if(ext->filter_bits_per_key) hashtable_filter_build(_hashtable);
+    HASHTABLE_METRICS_ONLY(ext->metrics.resize_nanoseconds += hashtable_metrics_now() - start;)
 }
 
 static double hashtable_get_cccupied_ratio(struct hashtable * _hashtable){
     hash_type i;
     uint32_t occupied;
-    for(occupied = 0, i = 0; i < 1<<_hashtable->bucket_size_exponent; i++){
+    for(occupied = 0, i = 0; i < _hashtable->buckets; i++){
         if(_hashtable->table[i]) occupied++;
         if(i == HASHTABLE_MAX_HASH)break;
     }
-    return (double)occupied/(1<<_hashtable->bucket_size_exponent);
+    return (double)occupied/_hashtable->buckets;
 }
 
 static hash_type hashtable_get_biggest_chain(struct hashtable * _hashtable){
     hash_type i;
     uint32_t max_global,max_chain;
     struct hashtable_bucket * temp;
-    for(i = 0, max_global=0; i < 1<<_hashtable->bucket_size_exponent; i++){
+    for(i = 0, max_global=0; i < _hashtable->buckets; i++){
         for(temp = _hashtable->table[i], max_chain=0; temp; temp=temp->next){
             max_chain++;
         }
@@ -120,90 +779,792 @@ static hash_type hashtable_get_biggest_chain(struct hashtable * _hashtable){
     return max_global;
 }
 
+/* A blocked Bloom filter errs with (set bits of the block / block bits) ^ hashes */
+static double hashtable_get_filter_fpr(struct hashtable * _hashtable){
+    const struct hashtable_filter * filter = &_hashtable->ext->filter;
+    hash_type blocks = (hash_type)1<<filter->block_exponent, i, j, set;
+    uint64_t word;
+    double fpr = 0;
+
+    for(i = 0; i < blocks; i++){
+        for(j = 0, set = 0; j < HASHTABLE_FILTER_BLOCK_BITS / 64; j++)
+            for(word = filter->blocks[i * (HASHTABLE_FILTER_BLOCK_BITS / 64) + j]; word; word &= word - 1) set++;
+        fpr += pow((double)set / HASHTABLE_FILTER_BLOCK_BITS, filter->hashes);
+    }
+    return fpr / blocks;
+}
+
 static double hashtable_get_loadfactor(struct hashtable * _hashtable){
-    return (double)_hashtable->items/(1<<_hashtable->bucket_size_exponent);
+    return (double)_hashtable->items/_hashtable->buckets;
 }
 
 static double hashtable_get_occupied_ratio(struct hashtable * _hashtable){
-    uint_fast64_t total = ((uint_fast64_t)1<<_hashtable->bucket_size_exponent);
+    uint_fast64_t total = _hashtable->buckets;
     uint_fast64_t hits = 0;
     while(--total+1){
         hits = _hashtable->table[total]!=NULL? hits+1 : hits;
     }
-    return (double)hits/(1<<_hashtable->bucket_size_exponent);
+    return (double)hits/_hashtable->buckets;
 }
 
 struct hashtable * hashtable_init(hash_type (*hash_func)(void * data),
                                   bool (*equal_func)(void * data1, void * data2)) {
-    return hashtable_init_size(hash_func,equal_func,HASHTABLE_DEFAULT_INIT_SIZE);
+    return hashtable_init_size(hash_func,equal_func,HASHTABLE_DEFAULT_INIT_SIZE,NULL);
 }
 
 struct hashtable * hashtable_init_size(hash_type (*hash_func)(void * data),
                                        bool (*equal_func)(void * data1, void * data2),
-                                       hash_type init_size) {
+                                       hash_type init_size,
+                                       const struct hashtable_allocator * allocator) {
     if(!nondeterministic_seed) HASHTABLE_SRANDOM, nondeterministic_seed = true;
 
     struct hashtable * new_hashtable;
+    bool compact = init_size <= HASHTABLE_COMPACT_CAPACITY;
+    /* Chained tables only use table and old_table of the union, one entry's worth */
+    size_t size = HASHTABLE_COMPACT_BYTES(compact && init_size ? init_size : 1);
 
-    if((new_hashtable = (struct hashtable*) malloc(sizeof(struct hashtable))) == NULL)
+    if((new_hashtable = (struct hashtable*) malloc(size)) == NULL)
         hashtable_insufficient_memory_error();
 
     new_hashtable->items                = 0;
-    new_hashtable->bucket_size_exponent = (uint8_t)ceil(log2(init_size < 2 ? 2 : init_size));
+    new_hashtable->buckets              = 0;
+    new_hashtable->grow_at              = compact && init_size ? init_size : 1;
     new_hashtable->seed                 = HASHTABLE_RANDOM;
     new_hashtable->hash_func            = hash_func;
     new_hashtable->equal_func           = equal_func;
+    new_hashtable->ext                  = NULL;
+    HASHTABLE_METRICS_ONLY(hashtable_extension(new_hashtable)->metrics.allocated_bytes += size;)
 
-    if ((new_hashtable->table=(struct hashtable_bucket **)calloc(1<<new_hashtable->bucket_size_exponent,sizeof(struct hashtable_bucket*))) == NULL)
+    if (allocator && allocator->kind == HASHTABLE_ALLOCATOR_SLAB){
+        if ((hashtable_extension(new_hashtable)->pool = (struct slab_pool*)malloc(sizeof(struct slab_pool))) == NULL)
+            hashtable_insufficient_memory_error();
+        slab_pool_init(new_hashtable->ext->pool,
+                       sizeof(struct hashtable_bucket),
+                       allocator->nodes_per_slab,
+                       allocator->arena_alloc,
+                       allocator->arena_free,
+                       allocator->arena);
+    }
+
+    if (compact)
+        return new_hashtable;
+
+    new_hashtable->buckets              = hashtable_fit_buckets(new_hashtable, init_size);
+    new_hashtable->old_table            = NULL;
+    hashtable_set_thresholds(new_hashtable);
+    if ((new_hashtable->table=(struct hashtable_bucket **)calloc(new_hashtable->buckets,sizeof(struct hashtable_bucket*))) == NULL)
         hashtable_insufficient_memory_error();
 
     return new_hashtable;
 }
 
-void hashtable_insert(struct hashtable * _hashtable,
-                      void * data){
-    if( _hashtable->items/(1<<_hashtable->bucket_size_exponent) >= HASHTABLE_LOAD_FACTOR)
+/*
+ * hashtable_build_from_array runs three phases on nthreads workers, with
+ * the join of one phase as the barrier before the next:
+ *
+ *   hash       every worker hashes its slice of keys and counts how many
+ *              land in each partition (a range of buckets)
+ *   scatter    after a prefix sum over (partition, worker), every worker
+ *              writes nodes for its slice into its own run of each
+ *              partition, so the nodes of a partition end up adjacent
+ *   link       every worker chains the nodes of the partitions it owns
+ *              into their buckets; partitions never share a bucket
+ */
+enum hashtable_build_phase{
+    HASHTABLE_BUILD_HASH,
+    HASHTABLE_BUILD_SCATTER,
+    HASHTABLE_BUILD_LINK
+};
+
+struct hashtable_build_worker{
+    pthread_t                   thread;
+    enum hashtable_build_phase  phase;
+    struct hashtable *          table;
+    void **                     keys;
+    hash_type *                 hashes;
+    struct hashtable_bucket *   nodes;
+    size_t                      first,last;
+    size_t *                    offsets;
+    const size_t *              partition_start;
+    unsigned                    index,nthreads;
+    size_t                      partitions;
+};
+
+static void * hashtable_build_work(void * argument) {
+    struct hashtable_build_worker * worker = (struct hashtable_build_worker*)argument;
+    struct hashtable * table = worker->table;
+    struct hashtable_bucket * node;
+    hash_type hash;
+    size_t i, partition;
+
+    switch(worker->phase){
+        case HASHTABLE_BUILD_HASH:
+            memset(worker->offsets, 0, worker->partitions * sizeof(size_t));
+            for(i = worker->first; i < worker->last; i++){
+                worker->hashes[i] = hashtable_hash(table, worker->keys[i]);
+                worker->offsets[hashtable_index(table, worker->hashes[i]) * worker->partitions / table->buckets]++;
+            }
+            break;
+        case HASHTABLE_BUILD_SCATTER:
+            for(i = worker->first; i < worker->last; i++){
+                node = &worker->nodes[worker->offsets[hashtable_index(table, worker->hashes[i]) * worker->partitions / table->buckets]++];
+                node->data = worker->keys[i];
+                node->value = NULL;
+                node->hash = worker->hashes[i];
+            }
+            break;
+        case HASHTABLE_BUILD_LINK:
+            for(partition = worker->index; partition < worker->partitions; partition += worker->nthreads){
+                for(i = worker->partition_start[partition]; i < worker->partition_start[partition+1]; i++){
+                    node = &worker->nodes[i];
+                    hash = hashtable_index(table, node->hash);
+                    node->next = table->table[hash];
+                    table->table[hash] = node;
+                }
+            }
+            break;
+    }
+    return NULL;
+}
+
+static void hashtable_build_run(struct hashtable_build_worker * workers,
+                                unsigned nthreads,
+                                enum hashtable_build_phase phase) {
+    unsigned i, started;
+
+    for(i = 0; i < nthreads; i++) workers[i].phase = phase;
+    for(i = 1; i < nthreads; i++)
+        if(pthread_create(&workers[i].thread, NULL, hashtable_build_work, &workers[i]) != 0)
+            break;
+    started = i;
+    hashtable_build_work(&workers[0]);
+    for(i = started; i < nthreads; i++)
+        hashtable_build_work(&workers[i]);
+    for(i = 1; i < started; i++)
+        pthread_join(workers[i].thread, NULL);
+}
+
+struct hashtable * hashtable_build_from_array(hash_type (*hash_func)(void * data),
+                                              bool (*equal_func)(void * data1, void * data2),
+                                              void ** keys,
+                                              size_t n,
+                                              unsigned nthreads) {
+    struct hashtable_allocator allocator = {HASHTABLE_ALLOCATOR_SLAB, 0, NULL, NULL, NULL};
+    struct hashtable * new_hashtable = hashtable_init_size(hash_func, equal_func, n, &allocator);
+    struct hashtable_build_worker * workers;
+    struct hashtable_bucket * nodes;
+    size_t partitions, * offsets, * partition_start, offset, count, p;
+    hash_type * hashes;
+    unsigned i;
+
+    if(hashtable_is_compact(new_hashtable)){
+        for(p = 0; p < n; p++) hashtable_insert(new_hashtable, keys[p]);
+        return new_hashtable;
+    }
+    if(!nthreads) nthreads = 1;
+    if(nthreads > n) nthreads = (unsigned)n;
+    partitions = (size_t)nthreads * HASHTABLE_BUILD_PARTITIONS;
+    if(partitions > new_hashtable->buckets) partitions = new_hashtable->buckets;
+
+    nodes = (struct hashtable_bucket*)slab_pool_alloc_bulk(new_hashtable->ext->pool, n);
+    if((workers = (struct hashtable_build_worker*)malloc(nthreads * sizeof(struct hashtable_build_worker))) == NULL ||
+       (offsets = (size_t*)malloc(nthreads * partitions * sizeof(size_t))) == NULL ||
+       (partition_start = (size_t*)malloc((partitions + 1) * sizeof(size_t))) == NULL ||
+       (hashes = (hash_type*)malloc(n * sizeof(hash_type))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    for(i = 0; i < nthreads; i++){
+        workers[i].table = new_hashtable;
+        workers[i].keys = keys;
+        workers[i].hashes = hashes;
+        workers[i].nodes = nodes;
+        workers[i].first = n * i / nthreads;
+        workers[i].last = n * (i + 1) / nthreads;
+        workers[i].offsets = offsets + i * partitions;
+        workers[i].partition_start = partition_start;
+        workers[i].index = i;
+        workers[i].nthreads = nthreads;
+        workers[i].partitions = partitions;
+    }
+
+    hashtable_build_run(workers, nthreads, HASHTABLE_BUILD_HASH);
+    for(p = 0, offset = 0; p < partitions; p++){
+        partition_start[p] = offset;
+        for(i = 0; i < nthreads; i++){
+            count = workers[i].offsets[p];
+            workers[i].offsets[p] = offset;
+            offset += count;
+        }
+    }
+    partition_start[partitions] = offset;
+    hashtable_build_run(workers, nthreads, HASHTABLE_BUILD_SCATTER);
+    hashtable_build_run(workers, nthreads, HASHTABLE_BUILD_LINK);
+    new_hashtable->items = n;
+    HASHTABLE_METRICS_ONLY(
+    new_hashtable->ext->metrics.inserts += n;
+    new_hashtable->ext->metrics.allocated_bytes += n * sizeof(struct hashtable_bucket);)
+
+    free(hashes);
+    free(partition_start);
+    free(offsets);
+    free(workers);
+    return new_hashtable;
+}
+
+static inline void hashtable_insert_hash(struct hashtable * _hashtable,
+                                         void * data,
+                                         hash_type full){
+    if(hashtable_is_compact(_hashtable)){
+        if(_hashtable->items < _hashtable->grow_at){
+            hashtable_compact_add(_hashtable, data, full);
+            return;
+        }
+        hashtable_compact_promote(_hashtable, hashtable_policy_buckets(_hashtable, _hashtable->items));
+    }else if(_hashtable->old_table)
+        hashtable_rehash_step(_hashtable, _hashtable->ext->rehash_steps);
+    else if(_hashtable->items >= _hashtable->grow_at)
         hashtable_expand(_hashtable);
-    hash_type hash = hashtable_hash(_hashtable,data);
-    _hashtable->table[hash] = hashtable_new_bucket(data, _hashtable->table[hash]);
+    full = hashtable_harden_check(_hashtable, data, full);
+    hash_type hash = hashtable_index(_hashtable,full);
+    hashtable_cow_own_bucket(_hashtable, hash);
+    _hashtable->table[hash] = hashtable_new_bucket(_hashtable, data, full, _hashtable->table[hash]);
     _hashtable->items++;
+    hashtable_filter_insert(_hashtable, full);
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.inserts++;)
+    if(_hashtable->ext->cache) hashtable_cache_admit(_hashtable, _hashtable->table[hash]);
+}
+
+/*
+ * Returns the value slot of the entry holding data, first adding one (with
+ * a NULL value) if there is none. The chain is walked once; growing, if
+ * due, only happens when an entry is actually added.
+ */
+static inline void ** hashtable_find_or_add(struct hashtable * _hashtable,
+                                            void * data,
+                                            hash_type full,
+                                            bool * inserted){
+    struct hashtable_compact_entry * entry;
+    struct hashtable_bucket ** link, * node;
+    hash_type hash;
+
+    if(hashtable_is_compact(_hashtable)){
+        if((entry = hashtable_compact_find(_hashtable,data,full))){
+            if(inserted) *inserted = false;
+            return &entry->value;
+        }
+        if(inserted) *inserted = true;
+        if(_hashtable->items < _hashtable->grow_at)
+            return &hashtable_compact_add(_hashtable, data, full)->value;
+        hashtable_compact_promote(_hashtable, hashtable_policy_buckets(_hashtable, _hashtable->items));
+    }else{
+        if(_hashtable->old_table)
+            hashtable_rehash_step(_hashtable, _hashtable->ext->rehash_steps);
+
+        /* The slot handed out is written to, so is the chain if data is new */
+        hashtable_cow_own(_hashtable, full);
+        link = hashtable_find(_hashtable,data,full);
+        hashtable_cache_lookup(_hashtable, link);
+        if(link){
+            if(inserted) *inserted = false;
+            return &(*link)->value;
+        }
+    }
+
+    if(!_hashtable->old_table && _hashtable->items >= _hashtable->grow_at)
+        hashtable_expand(_hashtable);
+    full = hashtable_harden_check(_hashtable, data, full);
+    hash = hashtable_index(_hashtable,full);
+    hashtable_cow_own_bucket(_hashtable, hash);
+    node = _hashtable->table[hash] = hashtable_new_bucket(_hashtable, data, full, _hashtable->table[hash]);
+    _hashtable->items++;
+    hashtable_filter_insert(_hashtable, full);
+    HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.inserts++;)
+    if(_hashtable->ext->cache) hashtable_cache_admit(_hashtable, node);
+    if(inserted) *inserted = true;
+    return &node->value;
+}
+
+/* Unlinks and frees the node holding data, handing out its key and value */
+static inline bool hashtable_remove_hash(struct hashtable * _hashtable,
+                                         void * data,
+                                         hash_type full,
+                                         void ** removed_data,
+                                         void ** removed_value) {
+    struct hashtable_compact_entry * entry;
+    struct hashtable_bucket ** link, * temp;
+    bool found = false;
+
+    /* Compact entries are unordered, the last one fills the hole */
+    if(hashtable_is_compact(_hashtable)){
+        if(!(entry = hashtable_compact_find(_hashtable,data,full))) return false;
+        if(removed_data) *removed_data = entry->data;
+        if(removed_value) *removed_value = entry->value;
+        *entry = _hashtable->compact[--_hashtable->items];
+        HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.deletes++;)
+        return true;
+    }
+
+    if(_hashtable->old_table)
+        hashtable_rehash_step(_hashtable, _hashtable->ext->rehash_steps);
+
+    link = hashtable_find(_hashtable,data,full);
+    /* Unlinking writes to the chain, which may still be shared */
+    if(link && (_hashtable->ext->shared || _hashtable->ext->old_shared)){
+        data = (*link)->data;
+        hashtable_cow_own(_hashtable, full);
+        link = hashtable_relink(_hashtable, data, full);
+    }
+    if (link){
+        temp = *link;
+        *link = temp->next;
+
+        if(removed_data) *removed_data = temp->data;
+        if(removed_value) *removed_value = temp->value;
+        if(_hashtable->ext->cache) _hashtable->ext->cache->bytes -= ((struct hashtable_cache_bucket*)temp)->bytes;
+        hashtable_free_bucket(_hashtable, temp);
+        _hashtable->items--;
+        HASHTABLE_METRICS_ONLY(_hashtable->ext->metrics.deletes++;)
+        if(_hashtable->ext->filter.blocks) _hashtable->ext->filter.stale++;
+        found = true;
+    }
+    if(!_hashtable->old_table && _hashtable->items < _hashtable->ext->shrink_at)
+        hashtable_collapse(_hashtable);
+    /* Bits of deleted keys only go away with a rebuild, amortized over the deletes */
+    if(_hashtable->ext->filter.blocks && !_hashtable->old_table &&
+       _hashtable->ext->filter.stale * 2 >= _hashtable->buckets)
+        hashtable_filter_build(_hashtable);
+    return found;
+}
+
+static inline void hashtable_delete_hash(struct hashtable * _hashtable,
+                                         void * data,
+                                         hash_type full,
+                                         void (*destroy)(void* data)) {
+    void * removed;
+
+    if(hashtable_remove_hash(_hashtable, data, full, &removed, NULL) && destroy)
+        destroy(removed);
+}
+
+void hashtable_insert(struct hashtable * _hashtable,
+                      void * data){
+    hashtable_insert_hash(_hashtable, data, hashtable_hash(_hashtable, data));
 }
 
 void * hashtable_query(struct hashtable * _hashtable,
                        void * data) {
-    hash_type hash = hashtable_hash(_hashtable,data);
-    struct hashtable_bucket * temp = _hashtable->table[hash];
+    struct hashtable_compact_entry * entry;
+    struct hashtable_bucket ** link;
 
-    while(temp){
-        if(_hashtable->equal_func(temp->data,data)) return temp->data;
-        else temp = temp->next;
+    if(hashtable_is_compact(_hashtable)){
+        entry = hashtable_compact_find(_hashtable,data,hashtable_hash(_hashtable, data));
+        return entry ? entry->data : NULL;
     }
-    return NULL;
+    /* Lookups drive a migration too, or a read-mostly table never finishes one */
+    if(_hashtable->old_table)
+        hashtable_rehash_step(_hashtable, _hashtable->ext->rehash_steps);
+    link = hashtable_find(_hashtable,data,hashtable_hash(_hashtable, data));
+    hashtable_cache_lookup(_hashtable, link);
+    return link ? (*link)->data : NULL;
 }
 
 void hashtable_delete(struct hashtable * _hashtable,
                       void * data,
                       void (*destroy)(void* data)) {
-    hash_type hash = hashtable_hash(_hashtable,data);
-    struct hashtable_bucket * temp = _hashtable->table[hash], * prev = NULL;
+    hashtable_delete_hash(_hashtable, data, hashtable_hash(_hashtable, data), destroy);
+}
+
+void * hashtable_get(struct hashtable * _hashtable,
+                     void * key) {
+    struct hashtable_compact_entry * entry;
+    struct hashtable_bucket ** link;
 
-    while(temp){
-        if(_hashtable->equal_func(temp->data,data))break;
-        else prev = temp, temp = temp->next;
+    if(hashtable_is_compact(_hashtable)){
+        entry = hashtable_compact_find(_hashtable,key,hashtable_hash(_hashtable, key));
+        return entry ? entry->value : NULL;
     }
-    if (temp){
-        if (prev) prev->next = temp->next;
-        else _hashtable->table[hash] = temp->next;
+    if(_hashtable->old_table)
+        hashtable_rehash_step(_hashtable, _hashtable->ext->rehash_steps);
+    link = hashtable_find(_hashtable,key,hashtable_hash(_hashtable, key));
+    hashtable_cache_lookup(_hashtable, link);
+    return link ? (*link)->value : NULL;
+}
+
+void * hashtable_upsert(struct hashtable * _hashtable,
+                        void * key,
+                        void * value) {
+    void ** slot = hashtable_find_or_add(_hashtable, key, hashtable_hash(_hashtable, key), NULL);
+    void * previous = *slot;
+
+    *slot = value;
+    /* The value is charged too, slot is the value field of the node */
+    if(_hashtable->ext && _hashtable->ext->cache && _hashtable->ext->cache->entry_size)
+        hashtable_cache_admit(_hashtable, (struct hashtable_bucket*)((char*)slot - offsetof(struct hashtable_bucket, value)));
+    return previous;
+}
+
+void ** hashtable_get_or_insert(struct hashtable * _hashtable,
+                                void * key,
+                                bool * inserted) {
+    return hashtable_find_or_add(_hashtable, key, hashtable_hash(_hashtable, key), inserted);
+}
+
+void * hashtable_remove_and_return(struct hashtable * _hashtable,
+                                   void * key,
+                                   void ** value) {
+    void * removed = NULL;
 
-        destroy(temp->data);
-        free(temp);
+    if(value) *value = NULL;
+    hashtable_remove_hash(_hashtable, key, hashtable_hash(_hashtable, key), &removed, value);
+    return removed;
+}
+
+static inline void hashtable_scan_chain(struct hashtable * _hashtable,
+                                        struct hashtable_bucket * chain,
+                                        hash_type first,
+                                        hash_type last,
+                                        void (*callback)(void * data, void * value, void * context),
+                                        void * context) {
+    struct hashtable_bucket * next;
+    hash_type position;
+
+    for(; chain; chain = next){
+        next = chain->next;
+        position = _hashtable->seed * chain->hash;
+        if(position >= first && position <= last)
+            callback(chain->data, chain->value, context);
     }
-    if(_hashtable->items/(1<<_hashtable->bucket_size_exponent) <= HASHTABLE_LOAD_FACTOR / 4)
-        hashtable_collapse(_hashtable);
+}
+
+/*
+ * The cursor is the first position not reported yet, with the seed
+ * generation in its low HASHTABLE_SCAN_GENERATION_BITS. A call reports the
+ * positions from the cursor up to the start of the next bucket, rounded up
+ * to keep those bits free, so it walks the cursor's bucket and, unless
+ * bucket boundaries are aligned (power of two bucket counts), the head of
+ * the next one too. After a shrink the cursor can point into the middle of
+ * a bucket, the part below it is skipped.
+ */
+hash_type hashtable_scan(struct hashtable * _hashtable,
+                         hash_type cursor,
+                         void (*callback)(void * data, void * value, void * context),
+                         void * context) {
+    hash_type mask = ((hash_type)1 << HASHTABLE_SCAN_GENERATION_BITS) - 1;
+    hash_type first, last, bucket;
+
+    /* A compact table is reported in one call, it never holds many entries */
+    if(hashtable_is_compact(_hashtable)){
+        for(bucket = 0; bucket < _hashtable->items; bucket++)
+            callback(_hashtable->compact[bucket].data, _hashtable->compact[bucket].value, context);
+        return 0;
+    }
+    if((cursor & mask) != (_hashtable->ext->generation & mask)) cursor = 0;
+    first = cursor & ~mask;
+    bucket = hashtable_bucket_of(first, _hashtable->buckets);
+    last = bucket + 1 < _hashtable->buckets ? hashtable_bucket_start(bucket + 1, _hashtable->buckets) : 0;
+    last = last && last <= HASHTABLE_MAX_HASH - mask ? ((last + mask) & ~mask) - 1 : HASHTABLE_MAX_HASH;
+
+    for(; bucket <= hashtable_bucket_of(last, _hashtable->buckets); bucket++)
+        hashtable_scan_chain(_hashtable, _hashtable->table[bucket], first, last, callback, context);
+    if(_hashtable->old_table){
+        for(bucket = hashtable_bucket_of(first, _hashtable->ext->old_buckets) < _hashtable->ext->rehash_index ?
+                     _hashtable->ext->rehash_index : hashtable_bucket_of(first, _hashtable->ext->old_buckets);
+            bucket <= hashtable_bucket_of(last, _hashtable->ext->old_buckets);
+            bucket++)
+            hashtable_scan_chain(_hashtable, _hashtable->old_table[bucket], first, last, callback, context);
+    }
+    return last == HASHTABLE_MAX_HASH ? 0 : (last + 1) | (_hashtable->ext->generation & mask);
+}
+
+struct hashtable_for_each_range{
+    pthread_t                   thread;
+    struct hashtable *          table;
+    hash_type                   first,last;
+    void                        (*callback)(void * data, void * value, void * context);
+    void *                      context;
+};
+
+static void * hashtable_for_each_range(void * argument) {
+    struct hashtable_for_each_range * range = (struct hashtable_for_each_range*)argument;
+    struct hashtable_bucket * temp, * next;
+    hash_type i;
+
+    for(i = range->first; i < range->last; i++){
+        for(temp = range->table->table[i]; temp; temp = next){
+            next = temp->next;
+            range->callback(temp->data, temp->value, range->context);
+        }
+    }
+    return NULL;
+}
+
+void hashtable_for_each_parallel(struct hashtable * _hashtable,
+                                 unsigned nthreads,
+                                 void (*callback)(void * data, void * value, void * context),
+                                 void * context) {
+    hash_type buckets = _hashtable->buckets;
+    struct hashtable_for_each_range * ranges, whole;
+    unsigned i, started;
+
+    if(hashtable_is_compact(_hashtable)){
+        hashtable_scan(_hashtable, 0, callback, context);
+        return;
+    }
+    hashtable_rehash_finish(_hashtable);
+    if(nthreads > buckets) nthreads = (unsigned)buckets;
+    if(nthreads <= 1){
+        whole.table = _hashtable;
+        whole.first = 0;
+        whole.last = buckets;
+        whole.callback = callback;
+        whole.context = context;
+        hashtable_for_each_range(&whole);
+        return;
+    }
+
+    if((ranges = (struct hashtable_for_each_range*)malloc(nthreads * sizeof(struct hashtable_for_each_range))) == NULL)
+        hashtable_insufficient_memory_error();
+    for(i = 0; i < nthreads; i++){
+        ranges[i].table = _hashtable;
+        ranges[i].first = buckets * i / nthreads;
+        ranges[i].last = buckets * (i + 1) / nthreads;
+        ranges[i].callback = callback;
+        ranges[i].context = context;
+    }
+    /* The caller takes the first range; ranges whose thread fails to start run inline */
+    for(i = 1; i < nthreads; i++)
+        if(pthread_create(&ranges[i].thread, NULL, hashtable_for_each_range, &ranges[i]) != 0)
+            break;
+    started = i;
+    hashtable_for_each_range(&ranges[0]);
+    for(i = started; i < nthreads; i++)
+        hashtable_for_each_range(&ranges[i]);
+    for(i = 1; i < started; i++)
+        pthread_join(ranges[i].thread, NULL);
+    free(ranges);
+}
+
+/*
+ * Batched operations work on groups of HASHTABLE_BATCH_GROUP keys: all
+ * hashes of a group are computed and their bucket slots prefetched first,
+ * then the chain heads, then the first nodes' data, so the cache misses of
+ * a whole group overlap instead of being paid one after the other. The
+ * prefetches are only hints, resolution goes through the scalar paths.
+ */
+void hashtable_query_batch(struct hashtable * _hashtable,
+                           void ** keys,
+                           size_t n,
+                           void ** results) {
+    hash_type hashes[HASHTABLE_BATCH_GROUP], index[HASHTABLE_BATCH_GROUP];
+    struct hashtable_bucket * heads[HASHTABLE_BATCH_GROUP], ** link;
+    size_t group, i, size;
+
+    if(hashtable_is_compact(_hashtable)){
+        for(i = 0; i < n; i++) results[i] = hashtable_query(_hashtable, keys[i]);
+        return;
+    }
+    for(group = 0; group < n; group += HASHTABLE_BATCH_GROUP){
+        size = n - group < HASHTABLE_BATCH_GROUP ? n - group : HASHTABLE_BATCH_GROUP;
+        /* One step per key, like hashtable_query, taken before the heads are read */
+        for(i = 0; i < size && _hashtable->old_table; i++)
+            hashtable_rehash_step(_hashtable, _hashtable->ext->rehash_steps);
+        for(i = 0; i < size; i++){
+            hashes[i] = hashtable_hash(_hashtable, keys[group+i]);
+            index[i] = hashtable_index(_hashtable, hashes[i]);
+            hashtable_prefetch(&_hashtable->table[index[i]]);
+        }
+        for(i = 0; i < size; i++)
+            if((heads[i] = _hashtable->table[index[i]])) hashtable_prefetch(heads[i]);
+        for(i = 0; i < size; i++)
+            if(heads[i] && heads[i]->hash == hashes[i]) hashtable_prefetch(heads[i]->data);
+        for(i = 0; i < size; i++){
+            link = hashtable_find(_hashtable, keys[group+i], hashes[i]);
+            hashtable_cache_lookup(_hashtable, link);
+            results[group+i] = link ? (*link)->data : NULL;
+        }
+    }
+}
+
+void hashtable_insert_batch(struct hashtable * _hashtable,
+                            void ** keys,
+                            size_t n) {
+    hash_type hashes[HASHTABLE_BATCH_GROUP];
+    size_t group, i, size;
+    bool keyed;
+
+    for(group = 0; group < n; group += HASHTABLE_BATCH_GROUP){
+        size = n - group < HASHTABLE_BATCH_GROUP ? n - group : HASHTABLE_BATCH_GROUP;
+        for(i = 0; i < size; i++){
+            hashes[i] = hashtable_hash(_hashtable, keys[group+i]);
+            if(!hashtable_is_compact(_hashtable))
+                hashtable_prefetch(&_hashtable->table[hashtable_index(_hashtable, hashes[i])]);
+        }
+        /* A hardened table can switch hashes in the middle of a group */
+        for(keyed = hashtable_keyed(_hashtable), i = 0; i < size; i++)
+            hashtable_insert_hash(_hashtable, keys[group+i],
+                                  hashtable_keyed(_hashtable) == keyed ? hashes[i] : hashtable_hash(_hashtable, keys[group+i]));
+    }
+}
+
+void hashtable_delete_batch(struct hashtable * _hashtable,
+                            void ** keys,
+                            size_t n,
+                            void (*destroy)(void* data)) {
+    hash_type hashes[HASHTABLE_BATCH_GROUP], index[HASHTABLE_BATCH_GROUP];
+    struct hashtable_bucket * head;
+    size_t group, i, size;
+
+    if(hashtable_is_compact(_hashtable)){
+        for(i = 0; i < n; i++) hashtable_delete(_hashtable, keys[i], destroy);
+        return;
+    }
+    for(group = 0; group < n; group += HASHTABLE_BATCH_GROUP){
+        size = n - group < HASHTABLE_BATCH_GROUP ? n - group : HASHTABLE_BATCH_GROUP;
+        for(i = 0; i < size; i++){
+            hashes[i] = hashtable_hash(_hashtable, keys[group+i]);
+            index[i] = hashtable_index(_hashtable, hashes[i]);
+            hashtable_prefetch(&_hashtable->table[index[i]]);
+        }
+        for(i = 0; i < size; i++)
+            if((head = _hashtable->table[index[i]])) hashtable_prefetch(head);
+        for(i = 0; i < size; i++)
+            hashtable_delete_hash(_hashtable, keys[group+i], hashes[i], destroy);
+    }
+}
+
+bool hashtable_set_cache(struct hashtable * _hashtable,
+                         const struct hashtable_cache * cache) {
+    struct slab_pool pool;
+
+    if(_hashtable->items) return false;
+    /* Nodes still shared with snapshots have the old size */
+    if(!hashtable_is_compact(_hashtable)){
+        hashtable_cow_reclaim(_hashtable);
+        if(_hashtable->ext->shared || _hashtable->ext->old_shared || _hashtable->ext->retired) return false;
+    }else if(!cache && !_hashtable->ext){
+        return true;
+    }
+    hashtable_extension(_hashtable);
+    free(_hashtable->ext->cache);
+    _hashtable->ext->cache = NULL;
+    if(cache){
+        if((_hashtable->ext->cache = (struct hashtable_cache*)malloc(sizeof(struct hashtable_cache))) == NULL)
+            hashtable_insufficient_memory_error();
+        *_hashtable->ext->cache = *cache;
+        _hashtable->ext->cache->hits = _hashtable->ext->cache->misses = _hashtable->ext->cache->evictions = 0;
+        _hashtable->ext->cache->bytes = 0;
+        _hashtable->ext->cache->hand = 0;
+        /* The CLOCK hand walks buckets, compact entries have no room for the bit */
+        if(hashtable_is_compact(_hashtable))
+            hashtable_compact_promote(_hashtable, HASHTABLE_MIN_BUCKETS);
+    }
+    /* Empty, so the pool can start over with the new node size */
+    if(_hashtable->ext->pool){
+        pool = *_hashtable->ext->pool;
+        slab_pool_destroy(_hashtable->ext->pool);
+        slab_pool_init(_hashtable->ext->pool, hashtable_node_size(_hashtable), pool.objects_per_slab,
+                       pool.arena_alloc, pool.arena_free, pool.arena);
+    }
+    return true;
+}
+
+void hashtable_set_hardened(struct hashtable * _hashtable,
+                            hash_type (*keyed_hash_func)(void * data, const uint64_t key[2])) {
+    hashtable_extension(_hashtable);
+    if(_hashtable->ext->keyed && keyed_hash_func == _hashtable->ext->keyed_hash_func) return;
+    _hashtable->ext->keyed_hash_func = keyed_hash_func;
+    if(_hashtable->ext->keyed) hashtable_rekey(_hashtable, keyed_hash_func != NULL);
+}
+
+void hashtable_set_incremental_rehash(struct hashtable * _hashtable,
+                                      hash_type buckets_per_step) {
+    if(!buckets_per_step) hashtable_rehash_finish(_hashtable);
+    hashtable_extension(_hashtable)->rehash_steps = buckets_per_step;
+}
+
+void hashtable_set_filter(struct hashtable * _hashtable,
+                          unsigned bits_per_key) {
+    hashtable_extension(_hashtable)->filter_bits_per_key = bits_per_key > UINT8_MAX ? UINT8_MAX : (uint8_t)bits_per_key;
+    if(hashtable_is_compact(_hashtable)) return;
+
+    hashtable_rehash_finish(_hashtable);
+    if(bits_per_key){
+        hashtable_filter_build(_hashtable);
+    }else{
+        free(_hashtable->ext->filter.blocks);
+        _hashtable->ext->filter.blocks = NULL;
+    }
+}
+
+bool hashtable_set_policy(struct hashtable * _hashtable,
+                          const struct hashtable_policy * policy) {
+    if(!(policy->max_load > 0 && policy->growth > 1 && policy->min_load >= 0 &&
+         policy->min_load * policy->growth < policy->max_load))
+        return false;
+    hashtable_extension(_hashtable)->policy = *policy;
+    if(!hashtable_is_compact(_hashtable)) hashtable_set_thresholds(_hashtable);
+    return true;
+}
+
+void hashtable_reserve(struct hashtable * _hashtable,
+                       hash_type n) {
+    hash_type buckets;
+
+    if(hashtable_is_compact(_hashtable)){
+        if(n <= _hashtable->grow_at) return;
+        hashtable_compact_promote(_hashtable, hashtable_fit_buckets(_hashtable, n));
+        return;
+    }
+    hashtable_rehash_finish(_hashtable);
+    if((buckets = hashtable_fit_buckets(_hashtable, n)) > _hashtable->buckets)
+        hashtable_resize(_hashtable, buckets, false);
+}
+
+void hashtable_shrink_to_fit(struct hashtable * _hashtable) {
+    hash_type buckets;
+
+    if(hashtable_is_compact(_hashtable)) return;
+    hashtable_rehash_finish(_hashtable);
+    if((buckets = hashtable_fit_buckets(_hashtable, _hashtable->items)) < _hashtable->buckets)
+        hashtable_resize(_hashtable, buckets, false);
+}
+
+bool hashtable_get_metrics(struct hashtable * _hashtable,
+                           struct hashtable_metrics * metrics) {
+#if defined(HASHTABLE_METRICS)
+    *metrics = _hashtable->ext->metrics;
+    metrics->items = _hashtable->items;
+    metrics->buckets = 0;
+    if(hashtable_is_compact(_hashtable))
+        return true;
+    metrics->allocated_bytes += sizeof(struct hashtable_bucket*) * _hashtable->buckets;
+    if(_hashtable->old_table)
+        metrics->allocated_bytes += sizeof(struct hashtable_bucket*) * _hashtable->ext->old_buckets;
+    if(_hashtable->ext->filter.blocks)
+        metrics->allocated_bytes += (HASHTABLE_FILTER_BLOCK_BITS / 8) << _hashtable->ext->filter.block_exponent;
+    if(_hashtable->ext->old_filter.blocks)
+        metrics->allocated_bytes += (HASHTABLE_FILTER_BLOCK_BITS / 8) << _hashtable->ext->old_filter.block_exponent;
+    metrics->buckets = _hashtable->buckets;
+    return true;
+#else
+    (void)_hashtable;
+    memset(metrics, 0, sizeof(struct hashtable_metrics));
+    return false;
+#endif
 }
 
 void hashtable_stats(struct hashtable * _hashtable) {
-    double nBuckets = 1<<_hashtable->bucket_size_exponent;
+    if(hashtable_is_compact(_hashtable)){
+        printf(" * Hashtable Statistics *\n");
+        printf("——————————————————————————\n");
+        printf("Seed         = %llu \n",(unsigned long long)_hashtable->seed);
+        printf("#Items       = %llu \n",(unsigned long long)_hashtable->items);
+        printf("Compact      = %llu slots\n",(unsigned long long)_hashtable->grow_at);
+        printf("——————————————————————————\n");
+        return;
+    }
+    hashtable_rehash_finish(_hashtable);
+    double nBuckets = _hashtable->buckets;
     double occupiedR = hashtable_get_occupied_ratio(_hashtable);
     printf(" * Hashtable Statistics *\n");
     printf("——————————————————————————\n");
@@ -217,6 +1578,22 @@ void hashtable_stats(struct hashtable * _hashtable) {
            100*pow(1-1/nBuckets, _hashtable->items),
            100*(1-occupiedR)-100*pow(1-1/nBuckets, _hashtable->items));
     printf("LoadFactor   = %0.2f\n",hashtable_get_loadfactor(_hashtable));
+    if(_hashtable->ext->filter.blocks){
+        printf("FilterBytes  = %llu \n",(unsigned long long)(HASHTABLE_FILTER_BLOCK_BITS / 8) << _hashtable->ext->filter.block_exponent);
+        printf("FilterFPR    = %0.3f%% (estimated)\n",100*hashtable_get_filter_fpr(_hashtable));
+#if defined(HASHTABLE_METRICS)
+        if(_hashtable->ext->metrics.filter_rejects + _hashtable->ext->metrics.filter_false_positives)
+            printf("FilterFPR    = %0.3f%% (observed)\n",
+                   100.0*_hashtable->ext->metrics.filter_false_positives/
+                   (_hashtable->ext->metrics.filter_rejects + _hashtable->ext->metrics.filter_false_positives));
+#endif
+    }
+    if(_hashtable->ext->cache){
+        printf("CacheBytes   = %llu \n",(unsigned long long)_hashtable->ext->cache->bytes);
+        printf("CacheHits    = %llu (%llu misses)\n",
+               (unsigned long long)_hashtable->ext->cache->hits,(unsigned long long)_hashtable->ext->cache->misses);
+        printf("Evictions    = %llu \n",(unsigned long long)_hashtable->ext->cache->evictions);
+    }
     printf("——————————————————————————\n");
 
 }
@@ -225,10 +1602,19 @@ void hashtable_print(struct hashtable * _hashtable) {
     hash_type i;
     struct hashtable_bucket * temp;
 
+    hashtable_rehash_finish(_hashtable);
     printf(" * Hashtable Content *\n");
     printf("———————————————————————");
 
-    for(i=0;i<1<<_hashtable->bucket_size_exponent;i++){
+    if(hashtable_is_compact(_hashtable)){
+        printf("\ncompact:");
+        for(i=0;i<_hashtable->items;i++)
+            printf("->(%llu)",(unsigned long long)*(uint64_t *)_hashtable->compact[i].data);
+        printf("\n———————————————————————\n");
+        return;
+    }
+
+    for(i=0;i<_hashtable->buckets;i++){
         printf("\n%llu:",i);
         for(temp=_hashtable->table[i];temp;temp=temp->next){
             printf("->(%llu)",*(uint64_t *)temp->data);
@@ -238,7 +1624,195 @@ void hashtable_print(struct hashtable * _hashtable) {
     printf("\n———————————————————————\n");
 }
 
+/*
+ * Reseeds while more buckets are empty than random placement predicts.
+ * Bounded: keys with equal hashes stay together under any seed, only a
+ * hardened table's keyed hash separates them.
+ */
 void hashtable_optimize(struct hashtable * _hashtable) {
-    while((1-hashtable_get_occupied_ratio(_hashtable))-pow(1-1/(double)(1<<_hashtable->bucket_size_exponent), _hashtable->items) > 0)
-        hashtable_rehash(_hashtable, _hashtable->bucket_size_exponent);
+    unsigned round;
+
+    if(hashtable_is_compact(_hashtable)) return;
+    hashtable_rehash_finish(_hashtable);
+    for(round = 0;
+        round < HASHTABLE_OPTIMIZE_ROUNDS &&
+        (1-hashtable_get_occupied_ratio(_hashtable))-pow(1-1/(double)_hashtable->buckets, _hashtable->items) > 0;
+        round++){
+        _hashtable->seed = HASHTABLE_RANDOM;
+        _hashtable->ext->generation++;
+        if(_hashtable->ext->shared){
+            hashtable_rehash_start(_hashtable, _hashtable->buckets);
+            hashtable_rehash_finish(_hashtable);
+        }else{
+            hashtable_rehash(_hashtable, _hashtable->buckets);
+        }
+    }
+}
+
+struct hashtable_snapshot * hashtable_snapshot(struct hashtable * _hashtable) {
+    struct hashtable_snapshot * snapshot;
+    struct hashtable_segment * segment;
+    hash_type segments, i, first;
+
+    if((snapshot = (struct hashtable_snapshot*)malloc(sizeof(struct hashtable_snapshot))) == NULL)
+        hashtable_insufficient_memory_error();
+    snapshot->segments = NULL;
+    snapshot->items = _hashtable->items;
+    snapshot->seed = _hashtable->seed;
+    snapshot->hash_func = _hashtable->hash_func;
+    snapshot->keyed = hashtable_keyed(_hashtable);
+    snapshot->keyed_hash_func = snapshot->keyed ? _hashtable->ext->keyed_hash_func : NULL;
+    snapshot->hash_key[0] = snapshot->keyed ? _hashtable->ext->hash_key[0] : 0;
+    snapshot->hash_key[1] = snapshot->keyed ? _hashtable->ext->hash_key[1] : 0;
+    snapshot->equal_func = _hashtable->equal_func;
+    if(hashtable_is_compact(_hashtable)){
+        snapshot->buckets = 0;
+        memcpy(snapshot->compact, _hashtable->compact, _hashtable->items * sizeof(struct hashtable_compact_entry));
+        return snapshot;
+    }
+    hashtable_rehash_finish(_hashtable);
+    hashtable_cow_reclaim(_hashtable);
+    snapshot->buckets = _hashtable->buckets;
+
+    /* Segments not written since the last snapshot are shared as they are */
+    segments = (_hashtable->buckets + HASHTABLE_SNAPSHOT_SEGMENT - 1) / HASHTABLE_SNAPSHOT_SEGMENT;
+    if((snapshot->segments = (struct hashtable_segment**)malloc(segments * sizeof(struct hashtable_segment*))) == NULL)
+        hashtable_insufficient_memory_error();
+    if(!_hashtable->ext->shared &&
+       (_hashtable->ext->shared = (struct hashtable_segment**)calloc(segments, sizeof(struct hashtable_segment*))) == NULL)
+        hashtable_insufficient_memory_error();
+    for(i = 0; i < segments; i++){
+        if(!(segment = _hashtable->ext->shared[i])){
+            if((segment = (struct hashtable_segment*)calloc(1, sizeof(struct hashtable_segment))) == NULL)
+                hashtable_insufficient_memory_error();
+            first = i * HASHTABLE_SNAPSHOT_SEGMENT;
+            memcpy(segment->heads, &_hashtable->table[first],
+                   (_hashtable->buckets - first < HASHTABLE_SNAPSHOT_SEGMENT ? _hashtable->buckets - first : HASHTABLE_SNAPSHOT_SEGMENT)
+                   * sizeof(struct hashtable_bucket*));
+            atomic_init(&segment->refs, 1);
+            _hashtable->ext->shared[i] = segment;
+            _hashtable->ext->shared_segments++;
+        }
+        atomic_fetch_add_explicit(&segment->refs, 1, memory_order_relaxed);
+        snapshot->segments[i] = segment;
+    }
+    return snapshot;
+}
+
+static inline hash_type hashtable_snapshot_hash(struct hashtable_snapshot * snapshot,
+                                                void * data) {
+    return snapshot->keyed ? snapshot->keyed_hash_func(data, snapshot->hash_key) : snapshot->hash_func(data);
+}
+
+static struct hashtable_bucket * hashtable_snapshot_find(struct hashtable_snapshot * snapshot,
+                                                         void * data) {
+    hash_type full = hashtable_snapshot_hash(snapshot, data);
+    hash_type bucket = hashtable_bucket_of(snapshot->seed * full, snapshot->buckets);
+    struct hashtable_bucket * temp;
+
+    for(temp = snapshot->segments[bucket / HASHTABLE_SNAPSHOT_SEGMENT]->heads[bucket % HASHTABLE_SNAPSHOT_SEGMENT];
+        temp; temp = temp->next)
+        if(temp->hash == full && snapshot->equal_func(temp->data, data))
+            return temp;
+    return NULL;
+}
+
+static struct hashtable_compact_entry * hashtable_snapshot_compact_find(struct hashtable_snapshot * snapshot,
+                                                                       void * data) {
+    hash_type full = hashtable_snapshot_hash(snapshot, data);
+    hash_type i;
+
+    for(i = 0; i < snapshot->items; i++)
+        if(snapshot->compact[i].hash == full && snapshot->equal_func(snapshot->compact[i].data, data))
+            return &snapshot->compact[i];
+    return NULL;
+}
+
+void * hashtable_snapshot_query(struct hashtable_snapshot * snapshot,
+                                void * data) {
+    struct hashtable_compact_entry * entry;
+    struct hashtable_bucket * temp;
+
+    if(!snapshot->segments)
+        return (entry = hashtable_snapshot_compact_find(snapshot, data)) ? entry->data : NULL;
+    return (temp = hashtable_snapshot_find(snapshot, data)) ? temp->data : NULL;
+}
+
+void * hashtable_snapshot_get(struct hashtable_snapshot * snapshot,
+                              void * key) {
+    struct hashtable_compact_entry * entry;
+    struct hashtable_bucket * temp;
+
+    if(!snapshot->segments)
+        return (entry = hashtable_snapshot_compact_find(snapshot, key)) ? entry->value : NULL;
+    return (temp = hashtable_snapshot_find(snapshot, key)) ? temp->value : NULL;
+}
+
+void hashtable_snapshot_for_each(struct hashtable_snapshot * snapshot,
+                                 void (*callback)(void * data, void * value, void * context),
+                                 void * context) {
+    struct hashtable_bucket * temp;
+    hash_type i;
+
+    if(!snapshot->segments){
+        for(i = 0; i < snapshot->items; i++)
+            callback(snapshot->compact[i].data, snapshot->compact[i].value, context);
+        return;
+    }
+    for(i = 0; i < snapshot->buckets; i++)
+        for(temp = snapshot->segments[i / HASHTABLE_SNAPSHOT_SEGMENT]->heads[i % HASHTABLE_SNAPSHOT_SEGMENT];
+            temp; temp = temp->next)
+            callback(temp->data, temp->value, context);
+}
+
+/* The table's thread frees segments once it gave them up and refs reaches 0 */
+void hashtable_snapshot_free(struct hashtable_snapshot * snapshot) {
+    hash_type i;
+
+    for(i = 0; snapshot->segments && i * HASHTABLE_SNAPSHOT_SEGMENT < snapshot->buckets; i++)
+        atomic_fetch_sub_explicit(&snapshot->segments[i]->refs, 1, memory_order_acq_rel);
+    free(snapshot->segments);
+    free(snapshot);
+}
+
+void hashtable_free(struct hashtable * _hashtable,
+                    void (*destroy)(void* data)) {
+    hash_type i;
+    struct hashtable_bucket * temp, * next;
+
+    if(hashtable_is_compact(_hashtable)){
+        for(i=0;destroy && i<_hashtable->items;i++)
+            destroy(_hashtable->compact[i].data);
+        if(_hashtable->ext && _hashtable->ext->pool){
+            slab_pool_destroy(_hashtable->ext->pool);
+            free(_hashtable->ext->pool);
+        }
+        free(_hashtable->ext);
+        free(_hashtable);
+        return;
+    }
+    hashtable_rehash_finish(_hashtable);
+    /* Without snapshots the shared segments hold the table's own nodes */
+    for(i = 0; _hashtable->ext->shared && i * HASHTABLE_SNAPSHOT_SEGMENT < _hashtable->buckets; i++)
+        free(_hashtable->ext->shared[i]);
+    free(_hashtable->ext->shared);
+    hashtable_cow_reclaim(_hashtable);
+
+    /* Slab nodes go back in bulk, chains only need a walk for destroy */
+    for(i=0;(destroy || !_hashtable->ext->pool) && i<_hashtable->buckets;i++){
+        for(temp=_hashtable->table[i];temp;temp=next){
+            next=temp->next;
+            if(destroy) destroy(temp->data);
+            if(!_hashtable->ext->pool) free(temp);
+        }
+    }
+    if(_hashtable->ext->pool){
+        slab_pool_destroy(_hashtable->ext->pool);
+        free(_hashtable->ext->pool);
+    }
+    free(_hashtable->ext->cache);
+    free(_hashtable->ext->filter.blocks);
+    free(_hashtable->ext);
+    free(_hashtable->table);
+    free(_hashtable);
 }
\ No newline at end of file
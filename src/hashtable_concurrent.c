@@ -0,0 +1,402 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../include/hashtable_concurrent.h"
+
+#include <stddef.h>
+
+#define HASHTABLE_CONCURRENT_STRIPES    ((hash_type)1<<HASHTABLE_CONCURRENT_STRIPE_EXPONENT)
+
+/* Stored in a migrated bucket of an old array, readers continue in array->next */
+static struct hashtable_concurrent_bucket hashtable_concurrent_forward_marker;
+#define HASHTABLE_CONCURRENT_FORWARD    (&hashtable_concurrent_forward_marker)
+
+#define hashtable_concurrent_metrics_add(_hashtable, field, amount) \
+    HASHTABLE_METRICS_ONLY(atomic_fetch_add_explicit(&(_hashtable)->metrics.field, (amount), memory_order_relaxed))
+
+#if defined(HASHTABLE_METRICS)
+static inline void hashtable_concurrent_record_lookup(struct hashtable_concurrent * _hashtable,
+                                                      bool hit,
+                                                      hash_type probes){
+    hashtable_concurrent_metrics_add(_hashtable, lookups, 1);
+    if(hit) hashtable_concurrent_metrics_add(_hashtable, hits, 1);
+    else hashtable_concurrent_metrics_add(_hashtable, misses, 1);
+    hashtable_concurrent_metrics_add(_hashtable, probe_lengths[hashtable_metrics_probe_slot(probes)], 1);
+}
+#else
+    #define hashtable_concurrent_record_lookup(_hashtable, hit, probes)    ((void)0)
+#endif
+
+#define hashtable_concurrent_container_of(entry, type) \
+    ((type*)((char*)(entry) - offsetof(type, retired)))
+
+static void hashtable_concurrent_reclaim_bucket(struct epoch_entry * entry){
+    struct hashtable_concurrent_bucket * bucket =
+            hashtable_concurrent_container_of(entry, struct hashtable_concurrent_bucket);
+    if(bucket->destroy) bucket->destroy(bucket->data);
+    free(bucket);
+}
+
+static void hashtable_concurrent_reclaim_array(struct epoch_entry * entry){
+    struct hashtable_concurrent_array * array =
+            hashtable_concurrent_container_of(entry, struct hashtable_concurrent_array);
+    free(array->stripe_migrated);
+    free(array);
+}
+
+static struct hashtable_concurrent_array * hashtable_concurrent_new_array(uint8_t bucket_size_exponent){
+    struct hashtable_concurrent_array * new_array;
+    hash_type i;
+
+    if((new_array = (struct hashtable_concurrent_array*)malloc(sizeof(struct hashtable_concurrent_array) +
+            sizeof(_Atomic(struct hashtable_concurrent_bucket *)) * ((hash_type)1<<bucket_size_exponent))) == NULL)
+        hashtable_insufficient_memory_error();
+    if((new_array->stripe_migrated = (uint8_t*)calloc(HASHTABLE_CONCURRENT_STRIPES, 1)) == NULL)
+        hashtable_insufficient_memory_error();
+
+    new_array->bucket_size_exponent = bucket_size_exponent;
+    atomic_init(&new_array->next, NULL);
+    atomic_init(&new_array->migrate_cursor, 0);
+    atomic_init(&new_array->migrated, 0);
+    for(i = 0; i < (hash_type)1<<bucket_size_exponent; i++)
+        atomic_init(&new_array->table[i], NULL);
+    return new_array;
+}
+
+static inline hash_type hashtable_concurrent_index(hash_type position,
+                                                   uint8_t exponent){
+    return position >> (HASHTABLE_WORD_SIZE - exponent);
+}
+
+/*
+ * Copies every chain of one stripe from array into next and leaves a
+ * forwarding marker behind. Nodes are copied rather than relinked because
+ * readers may still be walking the old chains. The caller holds the stripe
+ * lock; whoever migrates the last stripe publishes next as the current
+ * array.
+ */
+static void hashtable_concurrent_migrate(struct hashtable_concurrent * _hashtable,
+                                         struct hashtable_concurrent_array * array,
+                                         struct hashtable_concurrent_array * next,
+                                         hash_type stripe){
+    uint8_t shift = array->bucket_size_exponent - HASHTABLE_CONCURRENT_STRIPE_EXPONENT;
+    hash_type i, index;
+    struct hashtable_concurrent_bucket * temp, * following, * copy;
+    struct hashtable_concurrent_array * expected = array;
+    HASHTABLE_METRICS_ONLY(uint64_t start;)
+
+    if(array->stripe_migrated[stripe]) return;
+    HASHTABLE_METRICS_ONLY(start = hashtable_metrics_now();)
+
+    for(i = stripe << shift; i < (stripe+1) << shift; i++){
+        temp = atomic_load_explicit(&array->table[i], memory_order_relaxed);
+        for(; temp; temp = atomic_load_explicit(&temp->next, memory_order_relaxed)){
+            if((copy = (struct hashtable_concurrent_bucket*)malloc(sizeof(struct hashtable_concurrent_bucket))) == NULL)
+                hashtable_insufficient_memory_error();
+            copy->data = temp->data;
+            copy->hash = temp->hash;
+            copy->destroy = NULL;
+            index = hashtable_concurrent_index(_hashtable->seed * temp->hash, next->bucket_size_exponent);
+            atomic_init(&copy->next, atomic_load_explicit(&next->table[index], memory_order_relaxed));
+            atomic_store_explicit(&next->table[index], copy, memory_order_release);
+        }
+        temp = atomic_load_explicit(&array->table[i], memory_order_relaxed);
+        atomic_store_explicit(&array->table[i], HASHTABLE_CONCURRENT_FORWARD, memory_order_release);
+        for(; temp; temp = following){
+            following = atomic_load_explicit(&temp->next, memory_order_relaxed);
+            temp->destroy = NULL;
+            epoch_retire(&temp->retired, hashtable_concurrent_reclaim_bucket);
+        }
+    }
+    array->stripe_migrated[stripe] = 1;
+    hashtable_concurrent_metrics_add(_hashtable, resize_nanoseconds, hashtable_metrics_now() - start);
+
+    if(atomic_fetch_add(&array->migrated, 1) + 1 == HASHTABLE_CONCURRENT_STRIPES &&
+       atomic_compare_exchange_strong(&_hashtable->current, &expected, next))
+        epoch_retire(&array->retired, hashtable_concurrent_reclaim_array);
+}
+
+/* Newest array with the given stripe migrated into it, stripe lock held */
+static struct hashtable_concurrent_array * hashtable_concurrent_writable(struct hashtable_concurrent * _hashtable,
+                                                                        hash_type stripe){
+    struct hashtable_concurrent_array * array, * next;
+
+    array = atomic_load_explicit(&_hashtable->current, memory_order_acquire);
+    while((next = atomic_load_explicit(&array->next, memory_order_acquire))){
+        hashtable_concurrent_migrate(_hashtable, array, next, stripe);
+        array = next;
+    }
+    return array;
+}
+
+/* Claims and migrates one not yet migrated stripe, false once all are claimed */
+static bool hashtable_concurrent_help(struct hashtable_concurrent * _hashtable,
+                                      struct hashtable_concurrent_array * array,
+                                      struct hashtable_concurrent_array * next){
+    hash_type stripe = atomic_fetch_add(&array->migrate_cursor, 1);
+
+    if(stripe >= HASHTABLE_CONCURRENT_STRIPES) return false;
+    pthread_mutex_lock(&_hashtable->stripes[stripe].lock);
+    hashtable_concurrent_migrate(_hashtable, array, next, stripe);
+    pthread_mutex_unlock(&_hashtable->stripes[stripe].lock);
+    return true;
+}
+
+static void hashtable_concurrent_expand(struct hashtable_concurrent * _hashtable,
+                                        hash_type items){
+    struct hashtable_concurrent_array * array, * next, * expected = NULL;
+    int i;
+
+    array = atomic_load_explicit(&_hashtable->current, memory_order_acquire);
+    next = atomic_load_explicit(&array->next, memory_order_acquire);
+
+    if(!next){
+        if(items / ((hash_type)1<<array->bucket_size_exponent) < HASHTABLE_CONCURRENT_LOAD_FACTOR) return;
+        next = hashtable_concurrent_new_array(array->bucket_size_exponent + 1);
+        if(!atomic_compare_exchange_strong(&array->next, &expected, next)){
+            hashtable_concurrent_reclaim_array(&next->retired);
+            next = expected;
+        }else{
+            hashtable_concurrent_metrics_add(_hashtable, resizes, 1);
+            /* The resizing thread keeps going until every stripe is claimed */
+            while(hashtable_concurrent_help(_hashtable, array, next));
+            return;
+        }
+    }
+    for(i = 0; i < HASHTABLE_CONCURRENT_HELP_STRIPES; i++)
+        if(!hashtable_concurrent_help(_hashtable, array, next)) break;
+}
+
+struct hashtable_concurrent * hashtable_concurrent_init(hash_type (*hash_func)(void * data),
+                                                        bool (*equal_func)(void * data1, void * data2)) {
+    return hashtable_concurrent_init_size(hash_func,equal_func,HASHTABLE_DEFAULT_INIT_SIZE);
+}
+
+struct hashtable_concurrent * hashtable_concurrent_init_size(hash_type (*hash_func)(void * data),
+                                                             bool (*equal_func)(void * data1, void * data2),
+                                                             hash_type init_size) {
+    if(!nondeterministic_seed) HASHTABLE_SRANDOM, nondeterministic_seed = true;
+
+    struct hashtable_concurrent * new_hashtable;
+    uint8_t bucket_size_exponent = (uint8_t)ceil(log2(init_size < 2 ? 2 : init_size));
+    hash_type i;
+
+    /* A stripe must cover at least one bucket */
+    if(bucket_size_exponent < HASHTABLE_CONCURRENT_STRIPE_EXPONENT)
+        bucket_size_exponent = HASHTABLE_CONCURRENT_STRIPE_EXPONENT;
+
+    if((new_hashtable = (struct hashtable_concurrent*)aligned_alloc(_Alignof(struct hashtable_concurrent),
+            sizeof(struct hashtable_concurrent))) == NULL)
+        hashtable_insufficient_memory_error();
+    if((new_hashtable->stripes = (struct hashtable_concurrent_stripe*)aligned_alloc(_Alignof(struct hashtable_concurrent_stripe),
+            sizeof(struct hashtable_concurrent_stripe) * HASHTABLE_CONCURRENT_STRIPES)) == NULL)
+        hashtable_insufficient_memory_error();
+
+    for(i = 0; i < HASHTABLE_CONCURRENT_STRIPES; i++)
+        pthread_mutex_init(&new_hashtable->stripes[i].lock, NULL);
+
+    atomic_init(&new_hashtable->current, hashtable_concurrent_new_array(bucket_size_exponent));
+    atomic_init(&new_hashtable->items, 0);
+    new_hashtable->seed         = HASHTABLE_RANDOM | 1;
+    new_hashtable->hash_func    = hash_func;
+    new_hashtable->equal_func   = equal_func;
+    HASHTABLE_METRICS_ONLY(memset(&new_hashtable->metrics, 0, sizeof(struct hashtable_concurrent_metrics));)
+
+    return new_hashtable;
+}
+
+void hashtable_concurrent_insert(struct hashtable_concurrent * _hashtable,
+                                 void * data){
+    hash_type hash = _hashtable->hash_func(data), position = _hashtable->seed * hash, index, items;
+    hash_type stripe = hashtable_concurrent_index(position, HASHTABLE_CONCURRENT_STRIPE_EXPONENT);
+    struct hashtable_concurrent_bucket * new_bucket;
+    struct hashtable_concurrent_array * array;
+
+    if((new_bucket = (struct hashtable_concurrent_bucket*)malloc(sizeof(struct hashtable_concurrent_bucket))) == NULL)
+        hashtable_insufficient_memory_error();
+    new_bucket->data = data;
+    new_bucket->hash = hash;
+    new_bucket->destroy = NULL;
+
+    epoch_enter();
+    pthread_mutex_lock(&_hashtable->stripes[stripe].lock);
+    array = hashtable_concurrent_writable(_hashtable, stripe);
+    index = hashtable_concurrent_index(position, array->bucket_size_exponent);
+    atomic_init(&new_bucket->next, atomic_load_explicit(&array->table[index], memory_order_relaxed));
+    atomic_store_explicit(&array->table[index], new_bucket, memory_order_release);
+    pthread_mutex_unlock(&_hashtable->stripes[stripe].lock);
+
+    items = atomic_fetch_add_explicit(&_hashtable->items, 1, memory_order_relaxed) + 1;
+    hashtable_concurrent_metrics_add(_hashtable, inserts, 1);
+    hashtable_concurrent_expand(_hashtable, items);
+    epoch_exit();
+}
+
+void * hashtable_concurrent_query(struct hashtable_concurrent * _hashtable,
+                                  void * data) {
+    hash_type hash = _hashtable->hash_func(data), position = _hashtable->seed * hash;
+    struct hashtable_concurrent_array * array;
+    struct hashtable_concurrent_bucket * temp;
+    void * found = NULL;
+    HASHTABLE_METRICS_ONLY(hash_type probes = 0;)
+
+    epoch_enter();
+    array = atomic_load_explicit(&_hashtable->current, memory_order_acquire);
+    for(;;){
+        temp = atomic_load_explicit(&array->table[hashtable_concurrent_index(position, array->bucket_size_exponent)],
+                                    memory_order_acquire);
+        if(temp != HASHTABLE_CONCURRENT_FORWARD) break;
+        array = atomic_load_explicit(&array->next, memory_order_acquire);
+    }
+    for(; temp; temp = atomic_load_explicit(&temp->next, memory_order_acquire)){
+        HASHTABLE_METRICS_ONLY(probes++;)
+        if(temp->hash == hash && _hashtable->equal_func(temp->data, data)){
+            found = temp->data;
+            break;
+        }
+    }
+    epoch_exit();
+    hashtable_concurrent_record_lookup(_hashtable, found != NULL, probes);
+    return found;
+}
+
+void hashtable_concurrent_delete(struct hashtable_concurrent * _hashtable,
+                                 void * data,
+                                 void (*destroy)(void* data)) {
+    hash_type hash = _hashtable->hash_func(data), position = _hashtable->seed * hash;
+    hash_type stripe = hashtable_concurrent_index(position, HASHTABLE_CONCURRENT_STRIPE_EXPONENT);
+    struct hashtable_concurrent_array * array;
+    struct hashtable_concurrent_bucket * temp;
+    _Atomic(struct hashtable_concurrent_bucket *) * link;
+    HASHTABLE_METRICS_ONLY(hash_type probes = 0;)
+
+    epoch_enter();
+    pthread_mutex_lock(&_hashtable->stripes[stripe].lock);
+    array = hashtable_concurrent_writable(_hashtable, stripe);
+    link = &array->table[hashtable_concurrent_index(position, array->bucket_size_exponent)];
+    for(; (temp = atomic_load_explicit(link, memory_order_relaxed)); link = &temp->next){
+        HASHTABLE_METRICS_ONLY(probes++;)
+        if(temp->hash == hash && _hashtable->equal_func(temp->data, data)) break;
+    }
+    if(temp)
+        atomic_store_explicit(link, atomic_load_explicit(&temp->next, memory_order_relaxed), memory_order_release);
+    pthread_mutex_unlock(&_hashtable->stripes[stripe].lock);
+
+    hashtable_concurrent_record_lookup(_hashtable, temp != NULL, probes);
+    if(temp){
+        atomic_fetch_sub_explicit(&_hashtable->items, 1, memory_order_relaxed);
+        hashtable_concurrent_metrics_add(_hashtable, deletes, 1);
+        temp->destroy = destroy;
+        epoch_retire(&temp->retired, hashtable_concurrent_reclaim_bucket);
+    }
+    epoch_exit();
+}
+
+bool hashtable_concurrent_get_metrics(struct hashtable_concurrent * _hashtable,
+                                      struct hashtable_metrics * metrics) {
+#if defined(HASHTABLE_METRICS)
+    struct hashtable_concurrent_array * array, * next;
+    unsigned i;
+
+    metrics->lookups            = atomic_load_explicit(&_hashtable->metrics.lookups, memory_order_relaxed);
+    metrics->hits               = atomic_load_explicit(&_hashtable->metrics.hits, memory_order_relaxed);
+    metrics->misses             = atomic_load_explicit(&_hashtable->metrics.misses, memory_order_relaxed);
+    metrics->inserts            = atomic_load_explicit(&_hashtable->metrics.inserts, memory_order_relaxed);
+    metrics->deletes            = atomic_load_explicit(&_hashtable->metrics.deletes, memory_order_relaxed);
+    metrics->resizes            = atomic_load_explicit(&_hashtable->metrics.resizes, memory_order_relaxed);
+    metrics->resize_nanoseconds = atomic_load_explicit(&_hashtable->metrics.resize_nanoseconds, memory_order_relaxed);
+    metrics->filter_rejects = metrics->filter_false_positives = 0;
+    for(i = 0; i < HASHTABLE_METRICS_PROBE_LENGTHS; i++)
+        metrics->probe_lengths[i] = atomic_load_explicit(&_hashtable->metrics.probe_lengths[i], memory_order_relaxed);
+
+    epoch_enter();
+    array = atomic_load_explicit(&_hashtable->current, memory_order_acquire);
+    next = atomic_load_explicit(&array->next, memory_order_acquire);
+    metrics->items = atomic_load_explicit(&_hashtable->items, memory_order_relaxed);
+    metrics->buckets = (hash_type)1<<(next ? next : array)->bucket_size_exponent;
+    metrics->allocated_bytes = sizeof(struct hashtable_concurrent) +
+                               sizeof(struct hashtable_concurrent_stripe) * HASHTABLE_CONCURRENT_STRIPES +
+                               sizeof(struct hashtable_concurrent_bucket) * metrics->items +
+                               sizeof(_Atomic(struct hashtable_concurrent_bucket *)) * ((hash_type)1<<array->bucket_size_exponent);
+    if(next)
+        metrics->allocated_bytes += sizeof(_Atomic(struct hashtable_concurrent_bucket *)) * ((hash_type)1<<next->bucket_size_exponent);
+    epoch_exit();
+    return true;
+#else
+    (void)_hashtable;
+    memset(metrics, 0, sizeof(struct hashtable_metrics));
+    return false;
+#endif
+}
+
+void hashtable_concurrent_stats(struct hashtable_concurrent * _hashtable) {
+    struct hashtable_concurrent_array * array, * next;
+    struct hashtable_concurrent_bucket * temp;
+    hash_type i, chain, biggest = 0, occupied = 0, buckets;
+
+    epoch_enter();
+    array = atomic_load_explicit(&_hashtable->current, memory_order_acquire);
+    next = atomic_load_explicit(&array->next, memory_order_acquire);
+    buckets = (hash_type)1<<array->bucket_size_exponent;
+    for(i = 0; i < buckets; i++){
+        temp = atomic_load_explicit(&array->table[i], memory_order_acquire);
+        if(temp == HASHTABLE_CONCURRENT_FORWARD) continue;
+        for(chain = 0; temp; temp = atomic_load_explicit(&temp->next, memory_order_acquire)) chain++;
+        if(chain) occupied++;
+        biggest = chain > biggest ? chain : biggest;
+    }
+
+    printf(" * Concurrent Hashtable Statistics *\n");
+    printf("——————————————————————————\n");
+    printf("Seed         = %llu \n",(unsigned long long)_hashtable->seed);
+    printf("#Items       = %llu \n",(unsigned long long)atomic_load(&_hashtable->items));
+    printf("#Buckets     = %llu \n",(unsigned long long)buckets);
+    printf("#Stripes     = %llu \n",(unsigned long long)HASHTABLE_CONCURRENT_STRIPES);
+    printf("Migrated     = %llu/%llu stripes\n",
+           (unsigned long long)(next ? atomic_load(&array->migrated) : HASHTABLE_CONCURRENT_STRIPES),
+           (unsigned long long)HASHTABLE_CONCURRENT_STRIPES);
+    printf("BiggestChain = %llu \n",(unsigned long long)biggest);
+    printf("%%Occupied    = %0.2f%% \n",100*(double)occupied/buckets);
+    printf("LoadFactor   = %0.2f\n",(double)atomic_load(&_hashtable->items)/buckets);
+    printf("——————————————————————————\n");
+    epoch_exit();
+}
+
+/* Not thread safe, no other thread may use the table any more */
+void hashtable_concurrent_free(struct hashtable_concurrent * _hashtable,
+                               void (*destroy)(void* data)) {
+    struct hashtable_concurrent_array * array, * next;
+    struct hashtable_concurrent_bucket * temp, * following;
+    hash_type i;
+
+    for(array = atomic_load(&_hashtable->current); array; array = next){
+        next = atomic_load(&array->next);
+        for(i = 0; i < (hash_type)1<<array->bucket_size_exponent; i++){
+            temp = atomic_load_explicit(&array->table[i], memory_order_relaxed);
+            if(temp == HASHTABLE_CONCURRENT_FORWARD) continue;
+            for(; temp; temp = following){
+                following = atomic_load_explicit(&temp->next, memory_order_relaxed);
+                if(destroy) destroy(temp->data);
+                free(temp);
+            }
+        }
+        hashtable_concurrent_reclaim_array(&array->retired);
+    }
+    for(i = 0; i < HASHTABLE_CONCURRENT_STRIPES; i++)
+        pthread_mutex_destroy(&_hashtable->stripes[i].lock);
+    free(_hashtable->stripes);
+    free(_hashtable);
+    epoch_synchronize();
+}
@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../include/hashtable_file.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+static inline size_t hashtable_file_pad(size_t length){
+    return (length + 7) & ~(size_t)7;
+}
+
+static inline hash_type hashtable_file_index(hash_type seed,
+                                             hash_type buckets,
+                                             hash_type hash){
+    return hashtable_bucket_of(seed * hash, buckets);
+}
+
+/* Writes length bytes and zero padding up to the next multiple of 8 */
+static bool hashtable_file_write_blob(FILE * fp,
+                                      const void * blob,
+                                      size_t length){
+    static const char padding[8] = {0};
+    size_t pad = hashtable_file_pad(length) - length;
+
+    return (!length || fwrite(blob, 1, length, fp) == length) &&
+           (!pad || fwrite(padding, 1, pad, fp) == pad);
+}
+
+/*
+ * Nodes of the table (including a pending migration) sorted by bucket. The
+ * entries of a compact table are copied into scratch nodes first and laid
+ * out in buckets buckets like a chained table. Readers hash with hash_func,
+ * so a hardened table that switched to its keyed hash has its nodes
+ * copied to *copies (freed by the caller) with hash_func values.
+ */
+static struct hashtable_bucket ** hashtable_file_collect(struct hashtable * _hashtable,
+                                                         hash_type buckets,
+                                                         struct hashtable_bucket * scratch,
+                                                         struct hashtable_bucket ** copies,
+                                                         hash_type * counts,
+                                                         hash_type * items){
+    hash_type i, n = 0, index;
+    hash_type chained = _hashtable->buckets ? buckets : 0;
+    struct hashtable_bucket ** nodes, ** sorted, * temp;
+
+    for(i = 0; !chained && i < _hashtable->items; i++, n++){
+        scratch[i].data = _hashtable->compact[i].data;
+        scratch[i].value = _hashtable->compact[i].value;
+        scratch[i].hash = _hashtable->compact[i].hash;
+    }
+    for(i = 0; i < chained; i++)
+        for(temp = _hashtable->table[i]; temp; temp = temp->next) n++;
+    if(chained && _hashtable->old_table)
+        for(i = _hashtable->ext->rehash_index; i < _hashtable->ext->old_buckets; i++)
+            for(temp = _hashtable->old_table[i]; temp; temp = temp->next) n++;
+
+    if((nodes = (struct hashtable_bucket**)malloc((n ? n : 1) * sizeof(struct hashtable_bucket*))) == NULL ||
+       (sorted = (struct hashtable_bucket**)malloc((n ? n : 1) * sizeof(struct hashtable_bucket*))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    for(i = 0, n = 0; !chained && i < _hashtable->items; i++)
+        nodes[n++] = &scratch[i];
+    for(i = 0; i < chained; i++)
+        for(temp = _hashtable->table[i]; temp; temp = temp->next) nodes[n++] = temp;
+    if(chained && _hashtable->old_table)
+        for(i = _hashtable->ext->rehash_index; i < _hashtable->ext->old_buckets; i++)
+            for(temp = _hashtable->old_table[i]; temp; temp = temp->next) nodes[n++] = temp;
+
+    *copies = NULL;
+    if(_hashtable->ext && _hashtable->ext->keyed){
+        if((*copies = (struct hashtable_bucket*)malloc((n ? n : 1) * sizeof(struct hashtable_bucket))) == NULL)
+            hashtable_insufficient_memory_error();
+        for(i = 0; i < n; i++){
+            (*copies)[i] = *nodes[i];
+            (*copies)[i].hash = _hashtable->hash_func(nodes[i]->data);
+            nodes[i] = &(*copies)[i];
+        }
+    }
+
+    /* Counting sort, counts[b] ends up as the first position of bucket b */
+    memset(counts, 0, (buckets + 1) * sizeof(hash_type));
+    for(i = 0; i < n; i++)
+        counts[hashtable_file_index(_hashtable->seed, buckets, nodes[i]->hash) + 1]++;
+    for(i = 0; i < buckets; i++)
+        counts[i+1] += counts[i];
+    for(i = 0; i < n; i++){
+        index = hashtable_file_index(_hashtable->seed, buckets, nodes[i]->hash);
+        sorted[counts[index]++] = nodes[i];
+    }
+    for(i = buckets; i > 0; i--)
+        counts[i] = counts[i-1];
+    counts[0] = 0;
+
+    free(nodes);
+    *items = n;
+    return sorted;
+}
+
+int hashtable_save(struct hashtable * _hashtable,
+                   const char * path,
+                   size_t (*data_size)(void * data),
+                   size_t (*value_size)(void * value)){
+    hash_type buckets = _hashtable->buckets ? _hashtable->buckets : HASHTABLE_MIN_BUCKETS, items, i, j;
+    struct hashtable_bucket scratch[HASHTABLE_COMPACT_CAPACITY], * copies;
+    struct hashtable_file_header header;
+    struct hashtable_file_entry entry;
+    struct hashtable_bucket ** sorted;
+    hash_type * counts;
+    uint64_t * table, offset;
+    size_t * sizes, * value_sizes;
+    FILE * fp;
+    int error = 0;
+
+    if((counts = (hash_type*)malloc((buckets + 1) * sizeof(hash_type))) == NULL ||
+       (table = (uint64_t*)calloc(buckets, sizeof(uint64_t))) == NULL)
+        hashtable_insufficient_memory_error();
+    sorted = hashtable_file_collect(_hashtable, buckets, scratch, &copies, counts, &items);
+    if((sizes = (size_t*)malloc((items ? items : 1) * sizeof(size_t))) == NULL ||
+       (value_sizes = (size_t*)calloc(items ? items : 1, sizeof(size_t))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    offset = sizeof(header) + buckets * sizeof(uint64_t);
+    for(i = 0; i < buckets; i++){
+        if(counts[i] != counts[i+1]) table[i] = offset;
+        for(j = counts[i]; j < counts[i+1]; j++){
+            sizes[j] = data_size(sorted[j]->data);
+            if(value_size && sorted[j]->value) value_sizes[j] = value_size(sorted[j]->value);
+            offset += sizeof(entry) + hashtable_file_pad(sizes[j]) + hashtable_file_pad(value_sizes[j]);
+        }
+    }
+
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, HASHTABLE_FILE_MAGIC, sizeof(header.magic));
+    header.version              = HASHTABLE_FILE_VERSION;
+    header.buckets              = buckets;
+    header.seed                 = _hashtable->seed;
+    header.items                = items;
+    header.table_offset         = sizeof(header);
+    header.file_size            = offset;
+
+    if((fp = fopen(path, "wb")) == NULL){
+        error = -1;
+    }else{
+        if(fwrite(&header, sizeof(header), 1, fp) != 1 ||
+           fwrite(table, sizeof(uint64_t), buckets, fp) != buckets)
+            error = -1;
+        offset = sizeof(header) + buckets * sizeof(uint64_t);
+        for(i = 0; i < buckets && !error; i++){
+            for(j = counts[i]; j < counts[i+1] && !error; j++){
+                offset += sizeof(entry) + hashtable_file_pad(sizes[j]) + hashtable_file_pad(value_sizes[j]);
+                entry.next          = j + 1 < counts[i+1] ? offset : 0;
+                entry.hash          = sorted[j]->hash;
+                entry.key_length    = sizes[j];
+                entry.value_length  = value_sizes[j];
+                if(fwrite(&entry, sizeof(entry), 1, fp) != 1 ||
+                   !hashtable_file_write_blob(fp, sorted[j]->data, sizes[j]) ||
+                   !hashtable_file_write_blob(fp, sorted[j]->value, value_sizes[j]))
+                    error = -1;
+            }
+        }
+        if(fclose(fp) != 0) error = -1;
+    }
+
+    free(value_sizes);
+    free(sizes);
+    free(sorted);
+    free(copies);
+    free(table);
+    free(counts);
+    return error;
+}
+
+/*
+ * The entry at offset, or NULL if it or its blobs would reach past the
+ * mapping. Chains are written front to back, so a next offset has to grow,
+ * which also rules out cycles.
+ */
+static const struct hashtable_file_entry * hashtable_file_entry_at(struct hashtable_file * _file,
+                                                                   uint64_t offset,
+                                                                   uint64_t previous){
+    const struct hashtable_file_entry * entry;
+    uint64_t remaining;
+
+    if(offset <= previous || offset % 8 ||
+       offset > _file->length || _file->length - offset < sizeof(struct hashtable_file_entry))
+        return NULL;
+    entry = (const struct hashtable_file_entry*)(_file->base + offset);
+    remaining = _file->length - offset - sizeof(struct hashtable_file_entry);
+    if(entry->key_length > remaining || hashtable_file_pad(entry->key_length) > remaining ||
+       entry->value_length > remaining - hashtable_file_pad(entry->key_length))
+        return NULL;
+    return entry;
+}
+
+struct hashtable_file * hashtable_file_open(const char * path,
+                                            hash_type (*hash_func)(void * data),
+                                            bool (*equal_func)(void * data1,void * data2)){
+    const struct hashtable_file_header * header;
+    struct hashtable_file * new_file;
+    uint64_t buckets, i, entries;
+    struct stat st;
+    void * base;
+    int fd;
+
+    if((fd = open(path, O_RDONLY)) < 0) return NULL;
+    if(fstat(fd, &st) != 0){
+        close(fd);
+        return NULL;
+    }
+    if((size_t)st.st_size < sizeof(struct hashtable_file_header)){
+        close(fd);
+        errno = EINVAL;
+        return NULL;
+    }
+    base = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if(base == MAP_FAILED) return NULL;
+
+    header = (const struct hashtable_file_header*)base;
+    buckets = header->buckets;
+    if(memcmp(header->magic, HASHTABLE_FILE_MAGIC, sizeof(header->magic)) != 0 ||
+       header->version != HASHTABLE_FILE_VERSION ||
+       header->file_size != (uint64_t)st.st_size ||
+       header->table_offset < sizeof(struct hashtable_file_header) || header->table_offset % 8 ||
+       header->table_offset > header->file_size ||
+       buckets < 1 || buckets > (header->file_size - header->table_offset) / sizeof(uint64_t)){
+        munmap(base, (size_t)st.st_size);
+        errno = EINVAL;
+        return NULL;
+    }
+
+    if((new_file = (struct hashtable_file*)malloc(sizeof(struct hashtable_file))) == NULL)
+        hashtable_insufficient_memory_error();
+    new_file->base                  = (const uint8_t*)base;
+    new_file->length                = (size_t)st.st_size;
+    new_file->table                 = (const uint64_t*)(new_file->base + header->table_offset);
+    new_file->items                 = header->items;
+    new_file->seed                  = header->seed;
+    new_file->buckets               = buckets;
+    new_file->hash_func             = hash_func;
+    new_file->equal_func            = equal_func;
+
+    /* Chain heads must point at whole entries past the table */
+    entries = header->table_offset + buckets * sizeof(uint64_t) - 1;
+    for(i = 0; i < buckets; i++){
+        if(new_file->table[i] && !hashtable_file_entry_at(new_file, new_file->table[i], entries)){
+            munmap(base, (size_t)st.st_size);
+            free(new_file);
+            errno = EINVAL;
+            return NULL;
+        }
+    }
+    return new_file;
+}
+
+static const struct hashtable_file_entry * hashtable_file_find(struct hashtable_file * _file,
+                                                               void * data){
+    hash_type hash = _file->hash_func(data);
+    uint64_t offset = _file->table[hashtable_file_index(_file->seed, _file->buckets, hash)], previous = 0;
+    const struct hashtable_file_entry * entry;
+
+    for(; offset; previous = offset, offset = entry->next){
+        if(!(entry = hashtable_file_entry_at(_file, offset, previous))){
+            errno = EINVAL;
+            return NULL;
+        }
+        if(entry->hash == hash && _file->equal_func((void*)(entry + 1), data))
+            return entry;
+    }
+    return NULL;
+}
+
+void * hashtable_file_query(struct hashtable_file * _file,
+                            void * data){
+    const struct hashtable_file_entry * entry = hashtable_file_find(_file, data);
+    return entry ? (void*)(entry + 1) : NULL;
+}
+
+const void * hashtable_file_get(struct hashtable_file * _file,
+                                void * data,
+                                size_t * length){
+    const struct hashtable_file_entry * entry = hashtable_file_find(_file, data);
+
+    if(length) *length = entry ? entry->value_length : 0;
+    if(!entry || !entry->value_length) return NULL;
+    return (const uint8_t*)(entry + 1) + hashtable_file_pad(entry->key_length);
+}
+
+void hashtable_file_close(struct hashtable_file * _file){
+    munmap((void*)_file->base, _file->length);
+    free(_file);
+}
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/slab.h"
+#include "../include/hashtable.h"
+
+/* Objects start after the slab header, keep them pointer aligned */
+#define SLAB_HEADER_SIZE    ((sizeof(struct slab) + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*))
+
+/* Links a new slab of objects objects into the pool, returns its first object */
+static char * slab_pool_new_slab(struct slab_pool * pool,
+                                 size_t objects){
+    size_t size = SLAB_HEADER_SIZE + pool->object_size * objects;
+    struct slab * new_slab;
+
+    if(pool->arena_alloc) new_slab = (struct slab*)pool->arena_alloc(pool->arena, size);
+    else new_slab = (struct slab*)malloc(size);
+    if(new_slab == NULL) hashtable_insufficient_memory_error();
+
+    new_slab->next = pool->slabs;
+    pool->slabs = new_slab;
+    return (char*)new_slab + SLAB_HEADER_SIZE;
+}
+
+static void slab_pool_grow(struct slab_pool * pool){
+    pool->bump = slab_pool_new_slab(pool, pool->objects_per_slab);
+    pool->bump_end = pool->bump + pool->object_size * pool->objects_per_slab;
+}
+
+void slab_pool_init(struct slab_pool * pool,
+                    size_t object_size,
+                    size_t objects_per_slab,
+                    void * (*arena_alloc)(void * arena, size_t size),
+                    void (*arena_free)(void * arena, void * block),
+                    void * arena){
+    /* Freed objects hold the free list link */
+    if(object_size < sizeof(void*)) object_size = sizeof(void*);
+    object_size = (object_size + sizeof(void*) - 1) / sizeof(void*) * sizeof(void*);
+
+    pool->object_size       = object_size;
+    pool->objects_per_slab  = objects_per_slab ? objects_per_slab : SLAB_DEFAULT_OBJECTS;
+    pool->free_list         = NULL;
+    pool->bump              = NULL;
+    pool->bump_end          = NULL;
+    pool->slabs             = NULL;
+    pool->arena_alloc       = arena_alloc;
+    pool->arena_free        = arena_free;
+    pool->arena             = arena;
+}
+
+void * slab_pool_alloc(struct slab_pool * pool){
+    void * object;
+
+    if((object = pool->free_list)){
+        pool->free_list = *(void**)object;
+        return object;
+    }
+    if(pool->bump == pool->bump_end) slab_pool_grow(pool);
+    object = pool->bump;
+    pool->bump += pool->object_size;
+    return object;
+}
+
+void * slab_pool_alloc_bulk(struct slab_pool * pool,
+                           size_t count){
+    return slab_pool_new_slab(pool, count ? count : 1);
+}
+
+void slab_pool_free(struct slab_pool * pool,
+                    void * object){
+    *(void**)object = pool->free_list;
+    pool->free_list = object;
+}
+
+void slab_pool_destroy(struct slab_pool * pool){
+    struct slab * temp, * next;
+
+    for(temp = pool->slabs; temp; temp = next){
+        next = temp->next;
+        if(!pool->arena_alloc) free(temp);
+        else if(pool->arena_free) pool->arena_free(pool->arena, temp);
+    }
+    pool->slabs     = NULL;
+    pool->free_list = NULL;
+    pool->bump      = NULL;
+    pool->bump_end  = NULL;
+}
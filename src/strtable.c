@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../include/strtable.h"
+#include "../include/hashfunc.h"
+
+static inline hash_type strtable_hash(struct strtable * _strtable,
+                                      const char * key,
+                                      size_t length){
+    return hash64_bytes_seed(key, length, _strtable->seed);
+}
+
+/* Hash and length first, then the inline bytes, the rest of a long key last */
+static inline bool strtable_equal(const struct strtable_bucket * bucket,
+                                  const char * key,
+                                  size_t length,
+                                  hash_type hash){
+    if(bucket->hash != hash || bucket->length != length) return false;
+    if(length < STRTABLE_INLINE_KEY) return memcmp(bucket->key.bytes, key, length) == 0;
+    return memcmp(bucket->key.prefix, key, STRTABLE_PREFIX) == 0 &&
+           memcmp(bucket->key.heap + STRTABLE_PREFIX, key + STRTABLE_PREFIX, length - STRTABLE_PREFIX) == 0;
+}
+
+static struct strtable_bucket * strtable_new_bucket(const char * key,
+                                                    size_t length,
+                                                    hash_type hash,
+                                                    struct strtable_bucket * next){
+    struct strtable_bucket * new_bucket;
+
+    if((new_bucket = (struct strtable_bucket*)malloc(sizeof(struct strtable_bucket))) == NULL)
+        hashtable_insufficient_memory_error();
+    new_bucket->next = next;
+    new_bucket->hash = hash;
+    new_bucket->value = NULL;
+    new_bucket->length = length;
+    if(length < STRTABLE_INLINE_KEY){
+        memcpy(new_bucket->key.bytes, key, length);
+        new_bucket->key.bytes[length] = '\0';
+    }else{
+        if((new_bucket->key.heap = (char*)malloc(length + 1)) == NULL)
+            hashtable_insufficient_memory_error();
+        memcpy(new_bucket->key.heap, key, length);
+        new_bucket->key.heap[length] = '\0';
+        memcpy(new_bucket->key.prefix, key, STRTABLE_PREFIX);
+    }
+    return new_bucket;
+}
+
+static void strtable_free_bucket(struct strtable_bucket * bucket){
+    if(bucket->length >= STRTABLE_INLINE_KEY) free(bucket->key.heap);
+    free(bucket);
+}
+
+/* Nodes keep their hash, moving them never touches the keys */
+static void strtable_resize(struct strtable * _strtable,
+                            hash_type buckets){
+    struct strtable_bucket ** old_table = _strtable->table, * temp, * next;
+    hash_type i, old_buckets = _strtable->buckets, index;
+
+    if((_strtable->table = (struct strtable_bucket**)calloc(buckets, sizeof(struct strtable_bucket*))) == NULL)
+        hashtable_insufficient_memory_error();
+    _strtable->buckets = buckets;
+    for(i = 0; i < old_buckets; i++){
+        for(temp = old_table[i]; temp; temp = next){
+            next = temp->next;
+            index = hashtable_bucket_of(temp->hash, buckets);
+            temp->next = _strtable->table[index];
+            _strtable->table[index] = temp;
+        }
+    }
+    free(old_table);
+}
+
+static struct strtable_bucket ** strtable_find(struct strtable * _strtable,
+                                               const char * key,
+                                               size_t length,
+                                               hash_type hash){
+    struct strtable_bucket ** link = &_strtable->table[hashtable_bucket_of(hash, _strtable->buckets)];
+
+    for(; *link; link = &(*link)->next)
+        if(strtable_equal(*link, key, length, hash)) return link;
+    return NULL;
+}
+
+struct strtable * strtable_init(void) {
+    return strtable_init_size(STRTABLE_DEFAULT_INIT_SIZE);
+}
+
+struct strtable * strtable_init_size(hash_type init_size) {
+    if(!nondeterministic_seed) HASHTABLE_SRANDOM, nondeterministic_seed = true;
+
+    struct strtable * new_strtable;
+
+    if((new_strtable = (struct strtable*) malloc(sizeof(struct strtable))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    new_strtable->items     = 0;
+    new_strtable->seed      = HASHTABLE_RANDOM;
+    new_strtable->buckets   = init_size < STRTABLE_MIN_BUCKETS ? STRTABLE_MIN_BUCKETS : init_size;
+    if((new_strtable->table = (struct strtable_bucket**)calloc(new_strtable->buckets,
+                                                               sizeof(struct strtable_bucket*))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    return new_strtable;
+}
+
+void * strtable_get(struct strtable * _strtable,
+                    const char * key,
+                    size_t length) {
+    struct strtable_bucket ** link = strtable_find(_strtable, key, length, strtable_hash(_strtable, key, length));
+    return link ? (*link)->value : NULL;
+}
+
+void ** strtable_get_or_insert(struct strtable * _strtable,
+                               const char * key,
+                               size_t length,
+                               bool * inserted) {
+    hash_type hash = strtable_hash(_strtable, key, length), index;
+    struct strtable_bucket ** link;
+
+    if((link = strtable_find(_strtable, key, length, hash))){
+        if(inserted) *inserted = false;
+        return &(*link)->value;
+    }
+    if(inserted) *inserted = true;
+    if(_strtable->items >= _strtable->buckets)
+        strtable_resize(_strtable, _strtable->buckets * 2);
+    index = hashtable_bucket_of(hash, _strtable->buckets);
+    _strtable->table[index] = strtable_new_bucket(key, length, hash, _strtable->table[index]);
+    _strtable->items++;
+    return &_strtable->table[index]->value;
+}
+
+void * strtable_upsert(struct strtable * _strtable,
+                       const char * key,
+                       size_t length,
+                       void * value) {
+    void ** slot = strtable_get_or_insert(_strtable, key, length, NULL);
+    void * previous = *slot;
+
+    *slot = value;
+    return previous;
+}
+
+bool strtable_remove(struct strtable * _strtable,
+                     const char * key,
+                     size_t length,
+                     void ** value) {
+    struct strtable_bucket ** link = strtable_find(_strtable, key, length, strtable_hash(_strtable, key, length));
+    struct strtable_bucket * temp;
+
+    if(!link) return false;
+    temp = *link;
+    *link = temp->next;
+    if(value) *value = temp->value;
+    strtable_free_bucket(temp);
+    _strtable->items--;
+
+    if(_strtable->buckets > STRTABLE_MIN_BUCKETS && _strtable->items * 8 < _strtable->buckets)
+        strtable_resize(_strtable, _strtable->buckets / 2);
+    return true;
+}
+
+void strtable_for_each(struct strtable * _strtable,
+                       void (*callback)(const char * key, size_t length, void * value, void * context),
+                       void * context) {
+    struct strtable_bucket * temp, * next;
+    hash_type i;
+
+    for(i = 0; i < _strtable->buckets; i++){
+        for(temp = _strtable->table[i]; temp; temp = next){
+            next = temp->next;
+            callback(strtable_key(temp), temp->length, temp->value, context);
+        }
+    }
+}
+
+void strtable_free(struct strtable * _strtable,
+                   void (*destroy)(void* value)) {
+    struct strtable_bucket * temp, * next;
+    hash_type i;
+
+    for(i = 0; i < _strtable->buckets; i++){
+        for(temp = _strtable->table[i]; temp; temp = next){
+            next = temp->next;
+            if(destroy) destroy(temp->value);
+            strtable_free_bucket(temp);
+        }
+    }
+    free(_strtable->table);
+    free(_strtable);
+}
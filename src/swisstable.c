@@ -0,0 +1,267 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "../include/swisstable.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Layout: 2^group_size_exponent groups of SWISSTABLE_GROUP_WIDTH slots.
+ * The top 7 bits of the seeded hash are stored in the control byte (H2),
+ * the following group_size_exponent bits select the first group (H1).
+ * Groups are probed triangularly (g, g+1, g+3, g+6, ...), which visits
+ * every group exactly once since the group count is a power of two.
+ */
+
+static inline hash_type swisstable_capacity(struct swisstable * _swisstable){
+    return (hash_type)SWISSTABLE_GROUP_WIDTH << _swisstable->group_size_exponent;
+}
+
+static inline hash_type swisstable_hash(struct swisstable * _swisstable,
+                                        void * data){
+    return _swisstable->seed * _swisstable->hash_func(data);
+}
+
+static inline int8_t swisstable_h2(hash_type hash){
+    return (int8_t)(hash >> (HASHTABLE_WORD_SIZE - 7));
+}
+
+static inline hash_type swisstable_h1(struct swisstable * _swisstable,
+                                      hash_type hash){
+    return (hash << 7) >> (HASHTABLE_WORD_SIZE - _swisstable->group_size_exponent);
+}
+
+/* Bitmask with bit i set iff ctrl[i] == byte */
+static inline uint32_t swisstable_match(const int8_t * group,
+                                        int8_t byte){
+#if defined(__SSE2__)
+    __m128i ctrl = _mm_loadu_si128((const __m128i *)group);
+    return (uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(byte)));
+#else
+    uint32_t mask = 0;
+    int i;
+    for(i = 0; i < SWISSTABLE_GROUP_WIDTH; i++)
+        mask |= (uint32_t)(group[i] == byte) << i;
+    return mask;
+#endif
+}
+
+/* Bitmask of EMPTY and DELETED slots, both have the sign bit set */
+static inline uint32_t swisstable_match_free(const int8_t * group){
+#if defined(__SSE2__)
+    return (uint32_t)_mm_movemask_epi8(_mm_loadu_si128((const __m128i *)group));
+#else
+    uint32_t mask = 0;
+    int i;
+    for(i = 0; i < SWISSTABLE_GROUP_WIDTH; i++)
+        mask |= (uint32_t)(group[i] < 0) << i;
+    return mask;
+#endif
+}
+
+static inline int swisstable_lowest_bit(uint32_t mask){
+    return __builtin_ctz(mask);
+}
+
+static void swisstable_alloc(struct swisstable * _swisstable){
+    hash_type capacity = swisstable_capacity(_swisstable);
+
+    if((_swisstable->ctrl = (int8_t*)malloc(capacity)) == NULL)
+        hashtable_insufficient_memory_error();
+    if((_swisstable->slots = (void**)malloc(capacity * sizeof(void*))) == NULL)
+        hashtable_insufficient_memory_error();
+    memset(_swisstable->ctrl, SWISSTABLE_CTRL_EMPTY, capacity);
+    _swisstable->tombstones = 0;
+}
+
+/* Returns the index of the first EMPTY or DELETED slot on the probe sequence of hash */
+static hash_type swisstable_find_free(struct swisstable * _swisstable,
+                                      hash_type hash){
+    hash_type mask = ((hash_type)1 << _swisstable->group_size_exponent) - 1;
+    hash_type group = swisstable_h1(_swisstable, hash), step = 0;
+    uint32_t free_mask;
+
+    for(;;){
+        free_mask = swisstable_match_free(_swisstable->ctrl + group * SWISSTABLE_GROUP_WIDTH);
+        if(free_mask)
+            return group * SWISSTABLE_GROUP_WIDTH + swisstable_lowest_bit(free_mask);
+        group = (group + ++step) & mask;
+    }
+}
+
+static void swisstable_resize(struct swisstable * _swisstable,
+                              uint8_t group_size_exponent){
+    int8_t * old_ctrl = _swisstable->ctrl;
+    void ** old_slots = _swisstable->slots;
+    hash_type i, old_capacity = swisstable_capacity(_swisstable), hash, slot;
+
+    _swisstable->group_size_exponent = group_size_exponent;
+    _swisstable->seed = HASHTABLE_RANDOM | 1; /* Optional, increases Security*/
+    swisstable_alloc(_swisstable);
+
+    for(i = 0; i < old_capacity; i++){
+        if(old_ctrl[i] < 0) continue;
+        hash = swisstable_hash(_swisstable, old_slots[i]);
+        slot = swisstable_find_free(_swisstable, hash);
+        _swisstable->ctrl[slot] = swisstable_h2(hash);
+        _swisstable->slots[slot] = old_slots[i];
+    }
+    free(old_ctrl);
+    free(old_slots);
+}
+
+/* Returns the slot holding data, or capacity if absent */
+static hash_type swisstable_find(struct swisstable * _swisstable,
+                                 void * data){
+    hash_type mask = ((hash_type)1 << _swisstable->group_size_exponent) - 1;
+    hash_type hash = swisstable_hash(_swisstable, data);
+    hash_type group = swisstable_h1(_swisstable, hash), step = 0, slot;
+    int8_t h2 = swisstable_h2(hash);
+    const int8_t * ctrl;
+    uint32_t match;
+
+    for(;;){
+        ctrl = _swisstable->ctrl + group * SWISSTABLE_GROUP_WIDTH;
+        for(match = swisstable_match(ctrl, h2); match; match &= match - 1){
+            slot = group * SWISSTABLE_GROUP_WIDTH + swisstable_lowest_bit(match);
+            if(_swisstable->equal_func(_swisstable->slots[slot], data)) return slot;
+        }
+        if(swisstable_match(ctrl, SWISSTABLE_CTRL_EMPTY)) return swisstable_capacity(_swisstable);
+        if(step > mask) return swisstable_capacity(_swisstable);
+        group = (group + ++step) & mask;
+    }
+}
+
+struct swisstable * swisstable_init(hash_type (*hash_func)(void * data),
+                                    bool (*equal_func)(void * data1, void * data2)) {
+    return swisstable_init_size(hash_func,equal_func,SWISSTABLE_DEFAULT_INIT_SIZE);
+}
+
+struct swisstable * swisstable_init_size(hash_type (*hash_func)(void * data),
+                                         bool (*equal_func)(void * data1, void * data2),
+                                         hash_type init_size) {
+    if(!nondeterministic_seed) HASHTABLE_SRANDOM, nondeterministic_seed = true;
+
+    struct swisstable * new_swisstable;
+    hash_type groups = (init_size * SWISSTABLE_MAX_LOAD_DEN / SWISSTABLE_MAX_LOAD_NUM + SWISSTABLE_GROUP_WIDTH - 1)
+                       / SWISSTABLE_GROUP_WIDTH;
+
+    if((new_swisstable = (struct swisstable*) malloc(sizeof(struct swisstable))) == NULL)
+        hashtable_insufficient_memory_error();
+
+    new_swisstable->items               = 0;
+    new_swisstable->group_size_exponent = (uint8_t)ceil(log2(groups < 2 ? 2 : groups));
+    new_swisstable->seed                = HASHTABLE_RANDOM | 1;
+    new_swisstable->hash_func           = hash_func;
+    new_swisstable->equal_func          = equal_func;
+    swisstable_alloc(new_swisstable);
+
+    return new_swisstable;
+}
+
+void swisstable_insert(struct swisstable * _swisstable,
+                       void * data){
+    hash_type capacity = swisstable_capacity(_swisstable), hash, slot;
+
+    if((_swisstable->items + _swisstable->tombstones + 1) * SWISSTABLE_MAX_LOAD_DEN > capacity * SWISSTABLE_MAX_LOAD_NUM){
+        /* Mostly tombstones: rebuild in place, otherwise double */
+        if(_swisstable->items * 2 * SWISSTABLE_MAX_LOAD_DEN < capacity * SWISSTABLE_MAX_LOAD_NUM)
+            swisstable_resize(_swisstable, _swisstable->group_size_exponent);
+        else
+            swisstable_resize(_swisstable, _swisstable->group_size_exponent + 1);
+    }
+    hash = swisstable_hash(_swisstable, data);
+    slot = swisstable_find_free(_swisstable, hash);
+    if(_swisstable->ctrl[slot] == SWISSTABLE_CTRL_DELETED) _swisstable->tombstones--;
+    _swisstable->ctrl[slot] = swisstable_h2(hash);
+    _swisstable->slots[slot] = data;
+    _swisstable->items++;
+}
+
+void * swisstable_query(struct swisstable * _swisstable,
+                        void * data) {
+    hash_type slot = swisstable_find(_swisstable, data);
+    return slot == swisstable_capacity(_swisstable) ? NULL : _swisstable->slots[slot];
+}
+
+void swisstable_delete(struct swisstable * _swisstable,
+                       void * data,
+                       void (*destroy)(void* data)) {
+    hash_type capacity = swisstable_capacity(_swisstable);
+    hash_type slot = swisstable_find(_swisstable, data);
+    const int8_t * group;
+
+    if(slot == capacity) return;
+
+    /*
+     * A probe stops at the first group that still has an EMPTY slot, so
+     * the slot may only become EMPTY again if its group already has one.
+     */
+    group = _swisstable->ctrl + slot / SWISSTABLE_GROUP_WIDTH * SWISSTABLE_GROUP_WIDTH;
+    if(swisstable_match(group, SWISSTABLE_CTRL_EMPTY)){
+        _swisstable->ctrl[slot] = SWISSTABLE_CTRL_EMPTY;
+    }else{
+        _swisstable->ctrl[slot] = SWISSTABLE_CTRL_DELETED;
+        _swisstable->tombstones++;
+    }
+    if(destroy) destroy(_swisstable->slots[slot]);
+    _swisstable->items--;
+
+    if(_swisstable->group_size_exponent > 1 &&
+       _swisstable->items * SWISSTABLE_MAX_LOAD_DEN < capacity)
+        swisstable_resize(_swisstable, _swisstable->group_size_exponent - 1);
+}
+
+void swisstable_stats(struct swisstable * _swisstable) {
+    hash_type capacity = swisstable_capacity(_swisstable);
+    hash_type mask = ((hash_type)1 << _swisstable->group_size_exponent) - 1;
+    hash_type i, group, step, probes, total_probes = 0, max_probes = 0;
+
+    for(i = 0; i < capacity; i++){
+        if(_swisstable->ctrl[i] < 0) continue;
+        group = swisstable_h1(_swisstable, swisstable_hash(_swisstable, _swisstable->slots[i]));
+        for(step = 0, probes = 1; group != i / SWISSTABLE_GROUP_WIDTH; probes++)
+            group = (group + ++step) & mask;
+        total_probes += probes;
+        max_probes = probes > max_probes ? probes : max_probes;
+    }
+
+    printf(" * Swisstable Statistics *\n");
+    printf("——————————————————————————\n");
+    printf("Seed         = %llu \n",(unsigned long long)_swisstable->seed);
+    printf("#Items       = %llu \n",(unsigned long long)_swisstable->items);
+    printf("#Slots       = %llu \n",(unsigned long long)capacity);
+    printf("#Groups      = %llu \n",(unsigned long long)(mask + 1));
+    printf("#Tombstones  = %llu \n",(unsigned long long)_swisstable->tombstones);
+    printf("LongestProbe = %llu groups\n",(unsigned long long)max_probes);
+    printf("AvgProbe     = %0.2f groups\n",
+           _swisstable->items ? (double)total_probes/_swisstable->items : 0.0);
+    printf("LoadFactor   = %0.2f\n",(double)_swisstable->items/capacity);
+    printf("——————————————————————————\n");
+}
+
+void swisstable_free(struct swisstable * _swisstable,
+                     void (*destroy)(void* data)) {
+    hash_type i, capacity = swisstable_capacity(_swisstable);
+
+    if(destroy)
+        for(i = 0; i < capacity; i++)
+            if(_swisstable->ctrl[i] >= 0) destroy(_swisstable->slots[i]);
+    free(_swisstable->ctrl);
+    free(_swisstable->slots);
+    free(_swisstable);
+}
@@ -0,0 +1,52 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#ifndef C_HASH_TEST_H
+#define C_HASH_TEST_H
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+/*
+ * Minimal test harness: every test file is its own executable, CHECK
+ * reports failed conditions and TEST_RUN runs one test function. main
+ * returns test_result() so ctest sees the failure count.
+ */
+
+static int test_failures = 0;
+
+#define CHECK(condition)                                                    \
+    do{                                                                     \
+        if(!(condition)){                                                   \
+            fprintf(stderr,"%s:%d: CHECK(%s) failed\n",                     \
+                    __FILE__,__LINE__,#condition);                          \
+            test_failures++;                                                \
+        }                                                                   \
+    }while(0)
+
+#define TEST_RUN(test)                                                      \
+    do{                                                                     \
+        int failures = test_failures;                                       \
+        test();                                                             \
+        printf("%-40s %s\n",#test,failures == test_failures ? "ok" : "FAILED");\
+    }while(0)
+
+static inline int test_result(void){
+    return test_failures != 0;
+}
+
+#endif //C_HASH_TEST_H
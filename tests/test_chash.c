@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/chash.h"
+#include "test.h"
+
+CHASH_DECLARE(u64map, uint64_t, uint64_t, chash_hash_uint64, chash_equal)
+
+#define TEST_KEYS           (20000)
+
+static void test_put_get_delete(void){
+    struct u64map map;
+    uint64_t i, * value;
+
+    u64map_init(&map);
+    CHECK(u64map_get(&map, 1) == NULL);
+    for(i = 0; i < TEST_KEYS; i++)
+        u64map_put(&map, i << 20, i);
+    CHECK(u64map_size(&map) == TEST_KEYS);
+    u64map_put(&map, 0, 42);
+    CHECK(u64map_size(&map) == TEST_KEYS);
+    CHECK(*u64map_get(&map, 0) == 42);
+    for(i = 0; i < TEST_KEYS; i += 2)
+        CHECK(u64map_delete(&map, i << 20));
+    CHECK(!u64map_delete(&map, 0));
+    CHECK(u64map_size(&map) == TEST_KEYS / 2);
+    for(i = 1; i < TEST_KEYS; i++){
+        value = u64map_get(&map, i << 20);
+        CHECK(i % 2 ? value && *value == i : value == NULL);
+    }
+    u64map_free(&map);
+}
+
+static void test_iterate(void){
+    struct u64map map;
+    uint64_t i, sum = 0, count = 0;
+
+    u64map_init(&map);
+    for(i = 1; i <= 100; i++)
+        u64map_put(&map, i, i);
+    for(i = 0; i < map.capacity; i++)
+        if(u64map_exists(&map, i)){
+            sum += map.vals[i];
+            count++;
+        }
+    CHECK(count == 100);
+    CHECK(sum == 5050);
+    u64map_free(&map);
+}
+
+int main(void){
+    TEST_RUN(test_put_get_delete);
+    TEST_RUN(test_iterate);
+    return test_result();
+}
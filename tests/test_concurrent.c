@@ -0,0 +1,112 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/hashtable_concurrent.h"
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+#include "test.h"
+
+#define TEST_THREADS        (4)
+#define TEST_KEYS           (1 << 14)
+#define TEST_ROUNDS         (4)
+
+struct test_thread{
+    pthread_t                       thread;
+    struct hashtable_concurrent *   table;
+    hash_type                       first,last,failures;
+};
+
+static uint64_t keys[TEST_KEYS];
+
+/*
+ * Each thread inserts, checks and deletes its own slice of the keys a few
+ * times while the others do the same, so resizes and writes race on the
+ * stripes but every thread knows exactly what it must see.
+ */
+static void * test_worker(void * argument){
+    struct test_thread * self = (struct test_thread*)argument;
+    hash_type i, round;
+
+    for(round = 0; round < TEST_ROUNDS; round++){
+        for(i = self->first; i < self->last; i++)
+            hashtable_concurrent_insert(self->table, &keys[i]);
+        for(i = self->first; i < self->last; i++)
+            self->failures += hashtable_concurrent_query(self->table, &keys[i]) != &keys[i];
+        for(i = self->first; i < self->last; i += 2)
+            hashtable_concurrent_delete(self->table, &keys[i], NULL);
+        for(i = self->first; i < self->last; i++)
+            self->failures += (hashtable_concurrent_query(self->table, &keys[i]) != NULL) != (i % 2 == 1);
+        for(i = self->first + 1; i < self->last; i += 2)
+            hashtable_concurrent_delete(self->table, &keys[i], NULL);
+    }
+    return NULL;
+}
+
+static void test_threads(void){
+    struct hashtable_concurrent * table = hashtable_concurrent_init(hash64_uint64_t, equal_uint64_t);
+    struct test_thread threads[TEST_THREADS];
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    for(i = 0; i < TEST_THREADS; i++){
+        threads[i].table = table;
+        threads[i].first = i * TEST_KEYS / TEST_THREADS;
+        threads[i].last = (i + 1) * TEST_KEYS / TEST_THREADS;
+        threads[i].failures = 0;
+        pthread_create(&threads[i].thread, NULL, test_worker, &threads[i]);
+    }
+    for(i = 0; i < TEST_THREADS; i++){
+        pthread_join(threads[i].thread, NULL);
+        CHECK(threads[i].failures == 0);
+    }
+    for(i = 0; i < TEST_KEYS; i++)
+        CHECK(hashtable_concurrent_query(table, &keys[i]) == NULL);
+    hashtable_concurrent_free(table, NULL);
+}
+
+static struct epoch_entry test_entries[3];
+static int reclaimed;
+
+static void test_reclaim(struct epoch_entry * entry){
+    (void)entry;
+    reclaimed++;
+}
+
+static void * test_retire_and_exit(void * argument){
+    hash_type i;
+
+    (void)argument;
+    for(i = 0; i < 3; i++) epoch_retire(&test_entries[i], test_reclaim);
+    return NULL;
+}
+
+/* Limbo lists of an exited thread are reclaimed by the others */
+static void test_epoch_orphans(void){
+    pthread_t thread;
+
+    reclaimed = 0;
+    pthread_create(&thread, NULL, test_retire_and_exit, NULL);
+    pthread_join(thread, NULL);
+    CHECK(reclaimed == 0);
+    epoch_synchronize();
+    CHECK(reclaimed == 3);
+}
+
+int main(void){
+    TEST_RUN(test_threads);
+    TEST_RUN(test_epoch_orphans);
+    return test_result();
+}
@@ -0,0 +1,215 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/hashtable_file.h"
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+#include "test.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#define TEST_KEYS           (5000)
+
+static size_t test_string_size(void * data){
+    return strlen((char*)data) + 1;
+}
+
+static void test_save_open_query(void){
+    struct hashtable * table = hashtable_init(hash64_string, equal_string);
+    struct hashtable_file * file;
+    static char words[TEST_KEYS][16];
+    char path[] = "/tmp/chash_test_XXXXXX", probe[16];
+    char * found;
+    int i, fd;
+
+    CHECK((fd = mkstemp(path)) >= 0);
+    close(fd);
+    /* Leave a migration pending so both arrays get written */
+    hashtable_set_incremental_rehash(table, 1);
+    for(i = 0; i < TEST_KEYS; i++){
+        snprintf(words[i], sizeof(words[i]), "word%d", i);
+        hashtable_insert(table, words[i]);
+    }
+    CHECK(hashtable_save(table, path, test_string_size, NULL) == 0);
+    hashtable_free(table, NULL);
+
+    CHECK((file = hashtable_file_open(path, hash64_string, equal_string)) != NULL);
+    if(file){
+        CHECK(file->items == TEST_KEYS);
+        for(i = 0; i < TEST_KEYS * 2; i++){
+            snprintf(probe, sizeof(probe), "word%d", i);
+            found = (char*)hashtable_file_query(file, probe);
+            CHECK(i < TEST_KEYS ? found && strcmp(found, probe) == 0 : found == NULL);
+        }
+        hashtable_file_close(file);
+    }
+    unlink(path);
+}
+
+static void test_values(void){
+    struct hashtable * table = hashtable_init(hash64_string, equal_string);
+    struct hashtable_file * file;
+    char path[] = "/tmp/chash_test_XXXXXX";
+    const char * value;
+    size_t length;
+    int fd;
+
+    CHECK((fd = mkstemp(path)) >= 0);
+    close(fd);
+    hashtable_upsert(table, "apple", "red");
+    hashtable_upsert(table, "banana", "yellow, mostly");
+    hashtable_insert(table, "cherry");
+    CHECK(hashtable_save(table, path, test_string_size, test_string_size) == 0);
+    hashtable_free(table, NULL);
+
+    CHECK((file = hashtable_file_open(path, hash64_string, equal_string)) != NULL);
+    if(file){
+        value = (const char*)hashtable_file_get(file, "banana", &length);
+        CHECK(value && length == 15 && strcmp(value, "yellow, mostly") == 0);
+        value = (const char*)hashtable_file_get(file, "apple", &length);
+        CHECK(value && length == 4 && strcmp(value, "red") == 0);
+        CHECK(hashtable_file_get(file, "cherry", &length) == NULL && length == 0);
+        CHECK(hashtable_file_query(file, "cherry") != NULL);
+        CHECK(hashtable_file_get(file, "durian", NULL) == NULL);
+        hashtable_file_close(file);
+    }
+    unlink(path);
+}
+
+/* Every word of a length collides */
+static hash_type test_length_hash(void * data){
+    return strlen((char*)data);
+}
+
+/* A table that switched to its keyed hash is still saved with hash_func */
+static void test_hardened(void){
+    struct hashtable * table = hashtable_init(test_length_hash, equal_string);
+    struct hashtable_file * file;
+    static char words[1000][16];
+    char path[] = "/tmp/chash_test_XXXXXX";
+    int i, fd;
+
+    CHECK((fd = mkstemp(path)) >= 0);
+    close(fd);
+    hashtable_set_hardened(table, siphash_string);
+    for(i = 0; i < 1000; i++){
+        snprintf(words[i], sizeof(words[i]), "w%d", i);
+        hashtable_insert(table, words[i]);
+    }
+    CHECK(table->ext->keyed);
+    CHECK(hashtable_save(table, path, test_string_size, NULL) == 0);
+    hashtable_free(table, NULL);
+
+    CHECK((file = hashtable_file_open(path, test_length_hash, equal_string)) != NULL);
+    if(file){
+        for(i = 0; i < 1000; i++)
+            CHECK(hashtable_file_query(file, words[i]) != NULL);
+        CHECK(hashtable_file_query(file, "w1000") == NULL);
+        hashtable_file_close(file);
+    }
+    unlink(path);
+}
+
+static void test_malformed(void){
+    char path[] = "/tmp/chash_test_XXXXXX";
+    int fd;
+
+    CHECK((fd = mkstemp(path)) >= 0);
+    CHECK(write(fd, "not a hashtable file, not at all, not even close", 48) == 48);
+    close(fd);
+    errno = 0;
+    CHECK(hashtable_file_open(path, hash64_string, equal_string) == NULL);
+    CHECK(errno == EINVAL);
+    unlink(path);
+    CHECK(hashtable_file_open(path, hash64_string, equal_string) == NULL);
+}
+
+/* Saves three colliding keys to path, returns the offset of the chain head slot */
+static uint64_t test_save_chain(const char * path){
+    struct hashtable * table = hashtable_init(test_length_hash, equal_string);
+    struct hashtable_file_header header;
+    uint64_t head = 0, slot;
+    int fd;
+
+    hashtable_insert(table, "aaa");
+    hashtable_insert(table, "bbb");
+    hashtable_insert(table, "ccc");
+    CHECK(hashtable_save(table, path, test_string_size, NULL) == 0);
+    hashtable_free(table, NULL);
+    CHECK((fd = open(path, O_RDONLY)) >= 0);
+    CHECK(pread(fd, &header, sizeof(header), 0) == sizeof(header));
+    for(slot = header.table_offset; !head; slot += sizeof(uint64_t))
+        CHECK(pread(fd, &head, sizeof(head), (off_t)slot) == sizeof(head));
+    close(fd);
+    return slot - sizeof(uint64_t);
+}
+
+static void test_truncated(void){
+    struct hashtable_file_header header;
+    struct hashtable_file * file;
+    char path[] = "/tmp/chash_test_XXXXXX";
+    uint64_t slot, head, next = (uint64_t)1 << 40;
+    int fd;
+
+    CHECK((fd = mkstemp(path)) >= 0);
+    close(fd);
+
+    /* Cut off, file_size no longer matches */
+    test_save_chain(path);
+    CHECK((fd = open(path, O_RDWR)) >= 0);
+    CHECK(pread(fd, &header, sizeof(header), 0) == sizeof(header));
+    CHECK(ftruncate(fd, (off_t)header.file_size - 8) == 0);
+    close(fd);
+    errno = 0;
+    CHECK(hashtable_file_open(path, test_length_hash, equal_string) == NULL && errno == EINVAL);
+
+    /* Cut off with a matching file_size, the chain head now reaches past the end */
+    slot = test_save_chain(path);
+    CHECK((fd = open(path, O_RDWR)) >= 0);
+    CHECK(pread(fd, &header, sizeof(header), 0) == sizeof(header));
+    CHECK(pread(fd, &head, sizeof(head), (off_t)slot) == sizeof(head));
+    header.file_size = head + 8;
+    CHECK(ftruncate(fd, (off_t)header.file_size) == 0);
+    CHECK(pwrite(fd, &header, sizeof(header), 0) == sizeof(header));
+    close(fd);
+    errno = 0;
+    CHECK(hashtable_file_open(path, test_length_hash, equal_string) == NULL && errno == EINVAL);
+
+    /* A next offset past the end fails the lookups that follow it */
+    slot = test_save_chain(path);
+    CHECK((fd = open(path, O_RDWR)) >= 0);
+    CHECK(pread(fd, &head, sizeof(head), (off_t)slot) == sizeof(head));
+    CHECK(pwrite(fd, &next, sizeof(next), (off_t)head) == sizeof(next));
+    close(fd);
+    CHECK((file = hashtable_file_open(path, test_length_hash, equal_string)) != NULL);
+    if(file){
+        errno = 0;
+        CHECK(hashtable_file_query(file, "ddd") == NULL && errno == EINVAL);
+        hashtable_file_close(file);
+    }
+    unlink(path);
+}
+
+int main(void){
+    TEST_RUN(test_save_open_query);
+    TEST_RUN(test_values);
+    TEST_RUN(test_hardened);
+    TEST_RUN(test_malformed);
+    TEST_RUN(test_truncated);
+    return test_result();
+}
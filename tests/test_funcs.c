@@ -0,0 +1,68 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+#include "test.h"
+
+static void test_equal(void){
+    int8_t a8 = 1, b8 = 2;
+    int32_t a32 = 5, b32 = 5;
+    uint64_t a64 = 1, b64 = 2;
+    double ad = 0.5, bd = 0.5;
+
+    CHECK(!equal_int8_t(&a8, &b8));
+    CHECK(a8 == 1);
+    CHECK(equal_int32_t(&a32, &b32));
+    CHECK(!equal_uint64_t(&a64, &b64));
+    CHECK(a64 == 1);
+    CHECK(equal_double(&ad, &bd));
+    CHECK(equal_string("abc", "abc"));
+    CHECK(!equal_string("abc", "abd"));
+}
+
+static void test_hash64(void){
+    double zero = 0.0, negative_zero = -0.0;
+    uint64_t a = 1, b = 2;
+    char buffer[] = "the quick brown fox jumps over the lazy dog";
+
+    CHECK(hash64_double(&zero) == hash64_double(&negative_zero));
+    CHECK(hash64_uint64_t(&a) != hash64_uint64_t(&b));
+    CHECK(hash64_string(buffer) == hash64_bytes(buffer, strlen(buffer)));
+    CHECK(hash64_bytes_seed(buffer, 10, 1) != hash64_bytes_seed(buffer, 10, 2));
+    CHECK(hash64_bytes(buffer, 10) != hash64_bytes(buffer, 11));
+}
+
+/* Reference vectors from the SipHash paper, key 00 01 .. 0f */
+static void test_siphash(void){
+    const uint64_t key[2] = {0x0706050403020100ULL, 0x0f0e0d0c0b0a0908ULL}, other[2] = {1, 2};
+    uint8_t message[15];
+    uint64_t value = 42;
+    int i;
+
+    for(i = 0; i < 15; i++) message[i] = (uint8_t)i;
+    CHECK(siphash_bytes(message, 0, key) == 0x726fdb47dd0e0e31ULL);
+    CHECK(siphash_bytes(message, 15, key) == 0xa129ca6149be45e5ULL);
+    CHECK(siphash_string("abc", key) == siphash_bytes("abc", 3, key));
+    CHECK(siphash_uint64_t(&value, key) != siphash_uint64_t(&value, other));
+}
+
+int main(void){
+    TEST_RUN(test_equal);
+    TEST_RUN(test_hash64);
+    TEST_RUN(test_siphash);
+    return test_result();
+}
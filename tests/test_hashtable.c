@@ -0,0 +1,686 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/hashtable.h"
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+#include "test.h"
+
+#include <pthread.h>
+
+#define TEST_KEYS           (20000)
+
+static uint64_t keys[TEST_KEYS];
+static int destroyed;
+
+static void test_destroy(void * data){
+    (void)data;
+    destroyed++;
+}
+
+static void test_fill(struct hashtable * table){
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS; i++){
+        keys[i] = i * 7 + 3;
+        hashtable_insert(table, &keys[i]);
+    }
+}
+
+/* Keys at even positions get deleted, the others must survive */
+static void test_churn(struct hashtable * table){
+    hash_type i;
+    uint64_t probe;
+
+    test_fill(table);
+    for(i = 0; i < TEST_KEYS; i++){
+        probe = i * 7 + 3;
+        CHECK(hashtable_query(table, &probe) == &keys[i]);
+    }
+    for(i = 0; i < TEST_KEYS; i += 2)
+        hashtable_delete(table, &keys[i], test_destroy);
+    for(i = 0; i < TEST_KEYS; i++){
+        probe = i * 7 + 3;
+        CHECK((hashtable_query(table, &probe) != NULL) == (i % 2 == 1));
+    }
+    probe = 1;
+    CHECK(hashtable_query(table, &probe) == NULL);
+}
+
+static void test_insert_query_delete(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+
+    destroyed = 0;
+    test_churn(table);
+    CHECK(destroyed == TEST_KEYS / 2);
+    hashtable_free(table, test_destroy);
+    CHECK(destroyed == TEST_KEYS);
+}
+
+static void test_identity_hash(void){
+    struct hashtable * table = hashtable_init(hash_uint64_t, equal_uint64_t);
+
+    test_churn(table);
+    hashtable_free(table, NULL);
+}
+
+static void test_incremental_rehash(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hash_type i, n;
+
+    hashtable_set_incremental_rehash(table, 1);
+    test_churn(table);
+    /* Finishing a migration must not lose anything */
+    hashtable_set_incremental_rehash(table, 0);
+    CHECK(table->old_table == NULL);
+    for(i = 1; i < TEST_KEYS; i += 2)
+        CHECK(hashtable_query(table, &keys[i]) == &keys[i]);
+    hashtable_free(table, NULL);
+
+    /* Lookups alone drain a migration, a step per lookup */
+    table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, 16, NULL);
+    hashtable_set_incremental_rehash(table, 1);
+    for(i = 0; !table->old_table; i++) hashtable_insert(table, &keys[i]);
+    for(n = i, i = 0; table->old_table && i < table->ext->old_buckets; i++)
+        CHECK(i % 2 ? hashtable_query(table, &keys[i % n]) == &keys[i % n] : hashtable_get(table, &keys[i % n]) == NULL);
+    CHECK(table->old_table == NULL);
+    for(i = 0; i < n; i++)
+        CHECK(hashtable_query(table, &keys[i]) == &keys[i]);
+    hashtable_free(table, NULL);
+}
+
+static void test_slab_allocator(void){
+    struct hashtable_allocator allocator = {HASHTABLE_ALLOCATOR_SLAB, 64, NULL, NULL, NULL};
+    struct hashtable * table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, 16, &allocator);
+
+    destroyed = 0;
+    test_churn(table);
+    hashtable_free(table, test_destroy);
+    CHECK(destroyed == TEST_KEYS);
+}
+
+static void test_batch(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    static uint64_t probes[TEST_KEYS * 2];
+    static void * pointers[TEST_KEYS * 2], * results[TEST_KEYS * 2];
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS; i++){
+        keys[i] = i * 7 + 3;
+        pointers[i] = &keys[i];
+    }
+    hashtable_insert_batch(table, pointers, TEST_KEYS);
+    for(i = 0; i < TEST_KEYS * 2; i++){
+        probes[i] = i * 7 + 3;
+        pointers[i] = &probes[i];
+    }
+    hashtable_query_batch(table, pointers, TEST_KEYS * 2, results);
+    for(i = 0; i < TEST_KEYS * 2; i++)
+        CHECK(results[i] == (i < TEST_KEYS ? &keys[i] : NULL));
+
+    hashtable_delete_batch(table, pointers, TEST_KEYS / 2, NULL);
+    hashtable_query_batch(table, pointers, TEST_KEYS, results);
+    for(i = 0; i < TEST_KEYS; i++)
+        CHECK((results[i] != NULL) == (i >= TEST_KEYS / 2));
+    hashtable_free(table, NULL);
+}
+
+static void test_optimize(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hash_type i;
+
+    test_fill(table);
+    hashtable_optimize(table);
+    for(i = 0; i < TEST_KEYS; i++)
+        CHECK(hashtable_query(table, &keys[i]) == &keys[i]);
+    hashtable_free(table, NULL);
+}
+
+static void test_strings(void){
+    struct hashtable * table = hashtable_init(hash64_string, equal_string);
+    static char words[1000][16];
+    char probe[16];
+    int i;
+
+    for(i = 0; i < 1000; i++){
+        snprintf(words[i], sizeof(words[i]), "word%d", i);
+        hashtable_insert(table, words[i]);
+    }
+    for(i = 0; i < 1000; i++){
+        snprintf(probe, sizeof(probe), "word%d", i);
+        CHECK(hashtable_query(table, probe) == words[i]);
+    }
+    CHECK(hashtable_query(table, "word1000") == NULL);
+    hashtable_free(table, NULL);
+}
+
+static void test_map(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    void ** slot, * value;
+    bool inserted;
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS; i++){
+        keys[i] = i % 100;
+        slot = hashtable_get_or_insert(table, &keys[i], &inserted);
+        CHECK(inserted == (i < 100));
+        *slot = (void*)((uintptr_t)*slot + 1);
+    }
+    for(i = 0; i < 100; i++)
+        CHECK((uintptr_t)hashtable_get(table, &keys[i]) == TEST_KEYS / 100);
+
+    CHECK(hashtable_upsert(table, &keys[0], &keys[1]) == (void*)(uintptr_t)(TEST_KEYS / 100));
+    CHECK(hashtable_get(table, &keys[0]) == &keys[1]);
+    keys[TEST_KEYS - 1] = 1000;
+    CHECK(hashtable_upsert(table, &keys[TEST_KEYS - 1], &keys[2]) == NULL);
+    CHECK(hashtable_get(table, &keys[TEST_KEYS - 1]) == &keys[2]);
+    CHECK(hashtable_query(table, &keys[TEST_KEYS - 1]) == &keys[TEST_KEYS - 1]);
+
+    CHECK(hashtable_remove_and_return(table, &keys[100], &value) == &keys[0]);
+    CHECK(value == &keys[1]);
+    CHECK(hashtable_remove_and_return(table, &keys[100], &value) == NULL);
+    CHECK(value == NULL);
+    CHECK(hashtable_get(table, &keys[0]) == NULL);
+    CHECK(hashtable_query(table, &keys[0]) == NULL);
+    hashtable_free(table, NULL);
+}
+
+static void test_scan_count(void * data, void * value, void * context){
+    uint8_t * seen = (uint8_t*)context;
+    (void)value;
+    seen[*(uint64_t*)data]++;
+}
+
+/*
+ * Keys below TEST_KEYS / 2 stay for the whole scan and must be reported
+ * exactly once, while the others are added (growing the table) or removed
+ * (shrinking it) between the calls.
+ */
+static void test_scan_resize(hash_type init_size, hash_type rehash_steps, bool grow){
+    struct hashtable * table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, init_size, NULL);
+    static uint8_t seen[TEST_KEYS];
+    hash_type i, cursor = 0, calls = 0, stable = grow ? TEST_KEYS / 2 : 200, extra = stable;
+
+    hashtable_set_incremental_rehash(table, rehash_steps);
+    memset(seen, 0, sizeof(seen));
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    for(i = 0; i < (grow ? stable : 2 * stable); i++)
+        hashtable_insert(table, &keys[i]);
+    do{
+        cursor = hashtable_scan(table, cursor, test_scan_count, seen);
+        if(grow && extra < TEST_KEYS) hashtable_insert(table, &keys[extra++]);
+        if(!grow && extra < 2 * stable) hashtable_delete(table, &keys[extra++], NULL);
+        calls++;
+    }while(cursor);
+    for(i = 0; i < stable; i++)
+        CHECK(seen[i] == 1);
+    for(i = stable; i < TEST_KEYS; i++)
+        CHECK(seen[i] <= 1);
+    CHECK(calls <= table->buckets * 2 + TEST_KEYS);
+    hashtable_free(table, NULL);
+}
+
+static void test_scan(void){
+    test_scan_resize(2, 0, true);
+    test_scan_resize(2, 1, true);
+    test_scan_resize(4096, 0, false);
+    test_scan_resize(4096, 1, false);
+}
+
+static void test_for_each_sum(void * data, void * value, void * context){
+    (void)value;
+    __atomic_fetch_add((uint64_t*)context, *(uint64_t*)data, __ATOMIC_RELAXED);
+}
+
+static void test_for_each_parallel(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    uint64_t sum;
+    unsigned threads;
+
+    test_fill(table);
+    for(threads = 1; threads <= 8; threads *= 2){
+        sum = 0;
+        hashtable_for_each_parallel(table, threads, test_for_each_sum, &sum);
+        CHECK(sum == (uint64_t)TEST_KEYS * (TEST_KEYS - 1) / 2 * 7 + 3 * (uint64_t)TEST_KEYS);
+    }
+    hashtable_free(table, NULL);
+}
+
+static void test_build_from_array(void){
+    static void * pointers[TEST_KEYS];
+    struct hashtable * table;
+    hash_type i, extra = 1000000;
+    unsigned threads;
+    uint64_t probe;
+
+    for(i = 0; i < TEST_KEYS; i++){
+        keys[i] = i * 7 + 3;
+        pointers[i] = &keys[i];
+    }
+    for(threads = 0; threads <= 5; threads++){
+        table = hashtable_build_from_array(hash64_uint64_t, equal_uint64_t, pointers, TEST_KEYS, threads);
+        CHECK(table->items == TEST_KEYS);
+        CHECK(table->buckets >= TEST_KEYS);
+        for(i = 0; i < TEST_KEYS; i++){
+            probe = i * 7 + 3;
+            CHECK(hashtable_query(table, &probe) == &keys[i]);
+        }
+        /* Built tables behave like any other afterwards */
+        hashtable_insert(table, &extra);
+        CHECK(hashtable_query(table, &extra) == &extra);
+        for(i = 0; i < TEST_KEYS; i += 2)
+            hashtable_delete(table, &keys[i], NULL);
+        for(i = 0; i < TEST_KEYS; i++)
+            CHECK((hashtable_query(table, &keys[i]) != NULL) == (i % 2 == 1));
+        hashtable_free(table, NULL);
+    }
+    table = hashtable_build_from_array(hash64_uint64_t, equal_uint64_t, pointers, 0, 4);
+    CHECK(hashtable_query(table, &keys[0]) == NULL);
+    hashtable_free(table, NULL);
+}
+
+static void test_compact(void){
+    struct hashtable * table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, HASHTABLE_COMPACT_CAPACITY, NULL);
+    uint64_t sum = 0, probe;
+    hash_type i;
+    bool inserted;
+
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    for(i = 0; i < HASHTABLE_COMPACT_CAPACITY; i++)
+        CHECK(hashtable_upsert(table, &keys[i], &keys[i + 100]) == NULL);
+    CHECK(table->buckets == 0);
+    probe = 3;
+    CHECK(hashtable_get(table, &probe) == &keys[103]);
+    CHECK(*hashtable_get_or_insert(table, &probe, &inserted) == &keys[103] && !inserted);
+    probe = 100;
+    CHECK(hashtable_query(table, &probe) == NULL);
+    CHECK(hashtable_remove_and_return(table, &keys[0], NULL) == &keys[0]);
+    CHECK(hashtable_query(table, &keys[0]) == NULL);
+    CHECK(hashtable_query(table, &keys[HASHTABLE_COMPACT_CAPACITY - 1]) == &keys[HASHTABLE_COMPACT_CAPACITY - 1]);
+    CHECK(hashtable_scan(table, 0, test_for_each_sum, &sum) == 0);
+    CHECK(sum == (uint64_t)HASHTABLE_COMPACT_CAPACITY * (HASHTABLE_COMPACT_CAPACITY - 1) / 2);
+    CHECK(table->buckets == 0);
+
+    /* Promotion keeps keys and values */
+    for(i = HASHTABLE_COMPACT_CAPACITY; i < 100; i++) hashtable_insert(table, &keys[i]);
+    CHECK(table->buckets > 0);
+    for(i = 1; i < HASHTABLE_COMPACT_CAPACITY; i++)
+        CHECK(hashtable_get(table, &keys[i]) == &keys[i + 100]);
+    for(i = 1; i < 100; i++)
+        CHECK(hashtable_query(table, &keys[i]) == &keys[i]);
+    destroyed = 0;
+    hashtable_free(table, test_destroy);
+    CHECK(destroyed == 99);
+
+    table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hashtable_insert(table, &keys[1]);
+    destroyed = 0;
+    hashtable_free(table, test_destroy);
+    CHECK(destroyed == 1);
+
+    /* One key costs no more than a header, two bucket slots and a node did */
+    CHECK(HASHTABLE_COMPACT_BYTES(1) <= 10 * sizeof(void*));
+    table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, 1, NULL);
+#if !defined(HASHTABLE_METRICS)
+    CHECK(table->ext == NULL);
+#endif
+    hashtable_upsert(table, &keys[1], &keys[2]);
+    CHECK(table->buckets == 0 && hashtable_get(table, &keys[1]) == &keys[2]);
+    /* The capacity asked for is all there is */
+    hashtable_insert(table, &keys[3]);
+    CHECK(table->buckets > 0 && table->ext != NULL);
+    CHECK(hashtable_get(table, &keys[1]) == &keys[2] && hashtable_query(table, &keys[3]) == &keys[3]);
+    hashtable_free(table, NULL);
+}
+
+static void test_filter(void){
+    struct hashtable * table;
+    hash_type i, steps;
+    uint64_t probe;
+
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    for(steps = 0; steps <= 1; steps++){
+        table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+        hashtable_set_filter(table, 10);
+        hashtable_set_incremental_rehash(table, steps);
+        /* No false negatives, during migrations and across rebuilds either */
+        for(i = 0; i < TEST_KEYS; i++){
+            hashtable_insert(table, &keys[i]);
+            CHECK(hashtable_query(table, &keys[i / 2]) == &keys[i / 2]);
+        }
+        for(i = 0; i < TEST_KEYS; i += 2)
+            hashtable_delete(table, &keys[i], NULL);
+        for(i = 0; i < TEST_KEYS; i++)
+            CHECK((hashtable_query(table, &keys[i]) != NULL) == (i % 2 == 1));
+        for(probe = TEST_KEYS; probe < 2 * TEST_KEYS; probe++)
+            CHECK(hashtable_query(table, &probe) == NULL);
+        hashtable_set_filter(table, 0);
+        for(i = 1; i < TEST_KEYS; i += 2)
+            CHECK(hashtable_query(table, &keys[i]) == &keys[i]);
+        hashtable_free(table, NULL);
+    }
+}
+
+static void test_policy(void){
+    struct hashtable_policy policy = {0.75f, 0.1f, 2.0f}, bad = {1.0f, 0.6f, 2.0f};
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hash_type i, buckets, resizes;
+    uint64_t sum;
+
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    CHECK(!hashtable_set_policy(table, &bad));
+    CHECK(hashtable_set_policy(table, &policy));
+
+    /* Reserved capacity needs no resize, whatever the bucket count */
+    hashtable_reserve(table, 1001);
+    buckets = table->buckets;
+    CHECK(buckets >= 1001 / 0.75 && buckets < 1001 / 0.75 + 2);
+    for(i = 0; i < 1001; i++) hashtable_insert(table, &keys[i]);
+    CHECK(table->buckets == buckets && table->items == 1001);
+
+    /* Inserting and deleting around the grow threshold does not thrash */
+    while(table->items < table->grow_at) hashtable_insert(table, &keys[table->items]);
+    for(resizes = 0, i = 0; i < 1000; i++){
+        hashtable_insert(table, &keys[table->items]);
+        hashtable_delete(table, &keys[table->items - 1], NULL);
+        resizes += table->buckets != buckets;
+        buckets = table->buckets;
+    }
+    CHECK(resizes == 1);
+
+    /* Deletes shrink the table once it is sparse enough */
+    for(i = table->items; i > 100; i--) hashtable_delete(table, &keys[i - 1], NULL);
+    CHECK(table->items == 100 && table->buckets < buckets);
+    for(i = 0; i < 2000; i++)
+        CHECK((hashtable_query(table, &keys[i]) != NULL) == (i < 100));
+
+    /* Non power of two counts index, scan and delete like any other */
+    hashtable_reserve(table, 5000);
+    hashtable_shrink_to_fit(table);
+    CHECK(table->buckets == 134);
+    sum = 0;
+    i = 0;
+    do{
+        i = hashtable_scan(table, i, test_for_each_sum, &sum);
+    }while(i);
+    CHECK(sum == 99 * 100 / 2);
+    for(i = 0; i < 100; i += 2) hashtable_delete(table, &keys[i], NULL);
+    for(i = 0; i < 100; i++)
+        CHECK((hashtable_query(table, &keys[i]) != NULL) == (i % 2 == 1));
+    hashtable_free(table, NULL);
+}
+
+/* Keys in runs of 4096 share their hash, whatever the seed */
+static hash_type test_colliding_hash(void * data){
+    return *(uint64_t*)data & ~(uint64_t)0xfff;
+}
+
+static void test_hardened(void){
+    struct hashtable * plain = hashtable_init(test_colliding_hash, equal_uint64_t);
+    struct hashtable * table = hashtable_init(test_colliding_hash, equal_uint64_t);
+    struct hashtable_bucket * node;
+    hash_type i, generation, length;
+    uint64_t sum = 0;
+
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    hashtable_set_hardened(table, siphash_uint64_t);
+    for(i = 0; i < 2000; i++){
+        hashtable_insert(plain, &keys[i]);
+        hashtable_insert(table, &keys[i]);
+    }
+    CHECK(!plain->ext->keyed && table->ext->keyed);
+    for(i = 0; i < table->buckets; i++){
+        for(length = 0, node = table->table[i]; node; node = node->next) length++;
+        CHECK(length < HASHTABLE_HARDENED_CHAIN);
+    }
+    /* Optimize gives up on keys no seed separates */
+    generation = plain->ext->generation;
+    hashtable_optimize(plain);
+    CHECK(plain->ext->generation - generation <= HASHTABLE_OPTIMIZE_ROUNDS);
+
+    for(i = 0; i < 2000; i += 2) hashtable_delete(table, &keys[i], NULL);
+    for(i = 0; i < 2000; i++)
+        CHECK((hashtable_query(table, &keys[i]) != NULL) == (i % 2 == 1));
+    i = 0;
+    do{
+        i = hashtable_scan(table, i, test_for_each_sum, &sum);
+    }while(i);
+    CHECK(sum == 1000 * 1000);
+
+    /* Disarming goes back to hash_func */
+    generation = table->ext->generation;
+    hashtable_set_hardened(table, NULL);
+    CHECK(!table->ext->keyed && table->ext->generation == generation + 1);
+    for(i = 1; i < 2000; i += 2)
+        CHECK(hashtable_get(table, &keys[i]) == NULL && hashtable_query(table, &keys[i]) == &keys[i]);
+    hashtable_free(plain, NULL);
+    hashtable_free(table, NULL);
+}
+
+static size_t test_hundred_bytes(void * data, void * value){
+    (void)data;
+    return value ? 100 : 0;
+}
+
+static void test_cache(void){
+    struct hashtable_allocator allocator = {HASHTABLE_ALLOCATOR_SLAB, 64, NULL, NULL, NULL};
+    struct hashtable_cache items = {100, 0, NULL, test_destroy, 0, 0, 0, 0, 0};
+    struct hashtable_cache bytes = {0, 10 * (100 + sizeof(struct hashtable_cache_bucket)), test_hundred_bytes, NULL, 0, 0, 0, 0, 0};
+    struct hashtable * table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, 16, &allocator);
+    hash_type i, j;
+    uint64_t evictions;
+    bool inserted;
+
+    for(i = 0; i < TEST_KEYS; i++) keys[i] = i;
+    hashtable_insert(table, &keys[0]);
+    CHECK(!hashtable_set_cache(table, &items));
+    hashtable_delete(table, &keys[0], NULL);
+    CHECK(hashtable_set_cache(table, &items));
+
+    /* Entries looked up between inserts survive the sweeps */
+    destroyed = 0;
+    for(i = 10; i < 1010; i++){
+        hashtable_insert(table, &keys[i]);
+        if(i == 10) for(j = 0; j < 10; j++) hashtable_insert(table, &keys[j]);
+        for(j = 0; j < 10; j++) CHECK(hashtable_query(table, &keys[j]) == &keys[j]);
+        CHECK(table->items <= 100);
+    }
+    CHECK(table->items == 100);
+    CHECK(table->ext->cache->evictions == 910 && destroyed == 910);
+    CHECK(table->ext->cache->hits == 10000 && table->ext->cache->misses == 0);
+    CHECK(hashtable_query(table, &keys[10]) == NULL && table->ext->cache->misses == 1);
+    hashtable_free(table, NULL);
+
+    /* Byte budget, values are charged when stored */
+    table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    CHECK(hashtable_set_cache(table, &bytes));
+    for(i = 0; i < 100; i++){
+        hashtable_upsert(table, &keys[i], &keys[i]);
+        CHECK(table->ext->cache->bytes <= bytes.max_bytes);
+    }
+    CHECK(table->items == 10 && table->ext->cache->evictions == 90);
+    for(j = 0, i = 0; i < 100; i++) j += hashtable_get(table, &keys[i]) == &keys[i];
+    CHECK(j == 10 && hashtable_get(table, &keys[99]) == &keys[99]);
+    hashtable_delete(table, &keys[99], NULL);
+    CHECK(table->ext->cache->bytes == 9 * (100 + sizeof(struct hashtable_cache_bucket)));
+    hashtable_free(table, NULL);
+
+    /* The slot handed out is never the one evicted */
+    items.max_items = 1;
+    table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    CHECK(hashtable_set_cache(table, &items));
+    for(i = 0; i < 100; i++){
+        *hashtable_get_or_insert(table, &keys[i], &inserted) = &keys[i];
+        CHECK(inserted && table->items == 1 && hashtable_get(table, &keys[i]) == &keys[i]);
+    }
+    hashtable_free(table, NULL);
+
+    /* The hand sweeps old_table too, evicting does not finish a migration */
+    items.max_items = 100;
+    table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, 16, NULL);
+    hashtable_set_incremental_rehash(table, 1);
+    CHECK(hashtable_set_cache(table, &items));
+    for(j = 0, i = 0; i < TEST_KEYS; i++){
+        evictions = table->ext->cache->evictions;
+        hashtable_insert(table, &keys[i]);
+        CHECK(table->items <= 100);
+        j += table->ext->cache->evictions > evictions && table->old_table;
+    }
+    CHECK(j > 0 && table->items == 100);
+    for(j = 0, i = 0; i < TEST_KEYS; i++) j += hashtable_query(table, &keys[i]) == &keys[i];
+    CHECK(j == 100 && hashtable_query(table, &keys[TEST_KEYS - 1]) == &keys[TEST_KEYS - 1]);
+    hashtable_free(table, NULL);
+}
+
+struct test_snapshot_reader{
+    struct hashtable_snapshot * snapshot;
+    hash_type                   found;
+};
+
+static void * test_snapshot_read(void * argument){
+    struct test_snapshot_reader * reader = (struct test_snapshot_reader*)argument;
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS; i++)
+        reader->found += hashtable_snapshot_query(reader->snapshot, &keys[i]) == &keys[i];
+    return NULL;
+}
+
+static void test_snapshot(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    struct hashtable_snapshot * snapshot, * other, * third;
+    struct test_snapshot_reader reader;
+    pthread_t thread;
+    uint64_t sum = 0;
+    hash_type i, same;
+
+    test_fill(table);
+    snapshot = hashtable_snapshot(table);
+    other = hashtable_snapshot(table);
+    CHECK(snapshot->segments[0] == other->segments[0]);
+    hashtable_snapshot_free(other);
+
+    /* Writes copy segments, the snapshot keeps seeing the old chains */
+    reader.snapshot = snapshot;
+    reader.found = 0;
+    CHECK(pthread_create(&thread, NULL, test_snapshot_read, &reader) == 0);
+    for(i = 0; i < TEST_KEYS; i += 2) hashtable_delete(table, &keys[i], NULL);
+    for(i = 1; i < TEST_KEYS; i += 2) hashtable_upsert(table, &keys[i], &keys[i]);
+    pthread_join(thread, NULL);
+    CHECK(reader.found == TEST_KEYS);
+    CHECK(table->ext->shared == NULL && table->items == TEST_KEYS / 2);
+    for(i = 0; i < TEST_KEYS; i++){
+        CHECK(hashtable_snapshot_query(snapshot, &keys[i]) == &keys[i]);
+        CHECK(hashtable_snapshot_get(snapshot, &keys[i]) == NULL);
+        CHECK(hashtable_query(table, &keys[i]) == (i % 2 ? &keys[i] : NULL));
+    }
+    hashtable_snapshot_for_each(snapshot, test_for_each_sum, &sum);
+    CHECK(sum == (uint64_t)TEST_KEYS * (TEST_KEYS - 1) / 2 * 7 + 3 * (uint64_t)TEST_KEYS);
+
+    /* Only the written segment is new in the next snapshot */
+    other = hashtable_snapshot(table);
+    hashtable_insert(table, &keys[0]);
+    third = hashtable_snapshot(table);
+    for(same = 0, i = 0; i * HASHTABLE_SNAPSHOT_SEGMENT < table->buckets; i++)
+        same += other->segments[i] == third->segments[i];
+    CHECK(table->buckets > HASHTABLE_SNAPSHOT_SEGMENT && same == i - 1);
+    CHECK(hashtable_snapshot_query(third, &keys[0]) == &keys[0]);
+
+    /* A resize rebuilds the table from the shared segments */
+    hashtable_reserve(table, 4 * TEST_KEYS);
+    CHECK(table->ext->shared == NULL && table->ext->old_shared == NULL && table->old_table == NULL);
+    CHECK(hashtable_snapshot_query(third, &keys[0]) == &keys[0]);
+    hashtable_snapshot_free(third);
+    CHECK(hashtable_snapshot_query(other, &keys[0]) == NULL);
+    CHECK(hashtable_snapshot_get(other, &keys[1]) == &keys[1]);
+    CHECK(hashtable_get(table, &keys[1]) == &keys[1] && hashtable_query(table, &keys[0]) == &keys[0]);
+    hashtable_snapshot_free(other);
+    hashtable_snapshot_free(snapshot);
+
+    /* Without snapshots the table takes its nodes back */
+    snapshot = hashtable_snapshot(table);
+    hashtable_snapshot_free(snapshot);
+    hashtable_delete(table, &keys[0], NULL);
+    CHECK(table->ext->retired == NULL);
+    CHECK(hashtable_query(table, &keys[0]) == NULL && hashtable_query(table, &keys[1]) == &keys[1]);
+    destroyed = 0;
+    snapshot = hashtable_snapshot(table);
+    hashtable_snapshot_free(snapshot);
+    hashtable_free(table, test_destroy);
+    CHECK(destroyed == TEST_KEYS / 2);
+
+    /* A pending migration is finished first */
+    table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hashtable_set_incremental_rehash(table, 1);
+    test_fill(table);
+    snapshot = hashtable_snapshot(table);
+    CHECK(table->old_table == NULL);
+    for(i = 0; i < TEST_KEYS; i++) hashtable_delete(table, &keys[i], NULL);
+    for(i = 0; i < TEST_KEYS; i++) CHECK(hashtable_snapshot_query(snapshot, &keys[i]) == &keys[i]);
+    hashtable_snapshot_free(snapshot);
+    hashtable_free(table, NULL);
+
+    /* A migration started while shared copies segments as it reaches them */
+    table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hashtable_set_incremental_rehash(table, 1);
+    for(i = 0; i < 1000 || table->old_table || table->items + 1 < table->grow_at; i++)
+        hashtable_insert(table, &keys[i]);
+    snapshot = hashtable_snapshot(table);
+    for(same = i, sum = 0; i < TEST_KEYS; i++){
+        hashtable_insert(table, &keys[i]);
+        sum += table->ext->old_shared != NULL;
+    }
+    hashtable_set_incremental_rehash(table, 0);
+    CHECK(sum > 0 && table->ext->old_shared == NULL);
+    for(i = 0; i < TEST_KEYS; i++){
+        CHECK(hashtable_snapshot_query(snapshot, &keys[i]) == (i < same ? &keys[i] : NULL));
+        CHECK(hashtable_query(table, &keys[i]) == &keys[i]);
+    }
+    hashtable_snapshot_free(snapshot);
+    hashtable_free(table, NULL);
+
+    /* Compact tables are copied whole */
+    table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    hashtable_upsert(table, &keys[0], &keys[1]);
+    snapshot = hashtable_snapshot(table);
+    hashtable_upsert(table, &keys[0], &keys[2]);
+    for(i = 1; i < 100; i++) hashtable_insert(table, &keys[i]);
+    CHECK(hashtable_snapshot_get(snapshot, &keys[0]) == &keys[1]);
+    CHECK(hashtable_snapshot_query(snapshot, &keys[1]) == NULL);
+    hashtable_snapshot_free(snapshot);
+    hashtable_free(table, NULL);
+}
+
+int main(void){
+    TEST_RUN(test_insert_query_delete);
+    TEST_RUN(test_identity_hash);
+    TEST_RUN(test_incremental_rehash);
+    TEST_RUN(test_slab_allocator);
+    TEST_RUN(test_batch);
+    TEST_RUN(test_optimize);
+    TEST_RUN(test_strings);
+    TEST_RUN(test_map);
+    TEST_RUN(test_scan);
+    TEST_RUN(test_for_each_parallel);
+    TEST_RUN(test_build_from_array);
+    TEST_RUN(test_compact);
+    TEST_RUN(test_filter);
+    TEST_RUN(test_policy);
+    TEST_RUN(test_hardened);
+    TEST_RUN(test_cache);
+    TEST_RUN(test_snapshot);
+    return test_result();
+}
@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+/* Built with HASHTABLE_METRICS against its own copy of the sources */
+
+#include "../include/hashtable.h"
+#include "../include/hashtable_concurrent.h"
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+#include "test.h"
+
+#define TEST_KEYS           (1000)
+
+static uint64_t keys[TEST_KEYS * 2];
+
+static void test_check_counters(const struct hashtable_metrics * metrics){
+    uint64_t i, probed = 0;
+
+    CHECK(metrics->inserts == TEST_KEYS);
+    CHECK(metrics->deletes == TEST_KEYS / 2);
+    CHECK(metrics->lookups == TEST_KEYS * 2 + TEST_KEYS / 2);
+    CHECK(metrics->hits == TEST_KEYS + TEST_KEYS / 2);
+    CHECK(metrics->misses == TEST_KEYS);
+    for(i = 0; i < HASHTABLE_METRICS_PROBE_LENGTHS; i++) probed += metrics->probe_lengths[i];
+    CHECK(probed == metrics->lookups);
+    CHECK(metrics->probe_lengths[0] > 0);
+    CHECK(metrics->resizes > 0);
+    CHECK(metrics->allocated_bytes > metrics->buckets * sizeof(void*));
+}
+
+static void test_hashtable_metrics(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    struct hashtable_snapshot * snapshot;
+    struct hashtable_metrics metrics;
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS * 2; i++) keys[i] = i;
+    for(i = 0; i < TEST_KEYS; i++) hashtable_insert(table, &keys[i]);
+    for(i = 0; i < TEST_KEYS * 2; i++) hashtable_query(table, &keys[i]);
+    /* Deletes from chains shared with a snapshot count once too */
+    snapshot = hashtable_snapshot(table);
+    for(i = 0; i < TEST_KEYS / 2; i++) hashtable_delete(table, &keys[i], NULL);
+
+    CHECK(hashtable_get_metrics(table, &metrics));
+    test_check_counters(&metrics);
+    CHECK(metrics.buckets == table->buckets);
+    hashtable_snapshot_free(snapshot);
+    hashtable_free(table, NULL);
+}
+
+static void test_compact_metrics(void){
+    struct hashtable * table = hashtable_init_size(hash64_uint64_t, equal_uint64_t, HASHTABLE_COMPACT_CAPACITY, NULL);
+    struct hashtable_metrics metrics;
+    hash_type i;
+
+    /* A compact table is its header, plus the extension holding the counters */
+    for(i = 0; i < HASHTABLE_COMPACT_CAPACITY; i++) hashtable_insert(table, &keys[i]);
+    CHECK(hashtable_query(table, &keys[0]) == &keys[0]);
+    CHECK(hashtable_get_metrics(table, &metrics));
+    CHECK(metrics.allocated_bytes == HASHTABLE_COMPACT_BYTES(HASHTABLE_COMPACT_CAPACITY) + sizeof(struct hashtable_extension));
+    CHECK(metrics.buckets == 0 && metrics.items == HASHTABLE_COMPACT_CAPACITY);
+    CHECK(metrics.inserts == HASHTABLE_COMPACT_CAPACITY && metrics.hits == 1 && metrics.probe_lengths[1] == 1);
+    hashtable_insert(table, &keys[i]);
+    CHECK(hashtable_get_metrics(table, &metrics));
+    CHECK(metrics.buckets > 0 && metrics.resizes == 1);
+    CHECK(metrics.inserts == HASHTABLE_COMPACT_CAPACITY + 1);
+    hashtable_free(table, NULL);
+}
+
+static void test_filter_metrics(void){
+    struct hashtable * table = hashtable_init(hash64_uint64_t, equal_uint64_t);
+    struct hashtable_metrics metrics;
+    hash_type i;
+
+    hashtable_set_filter(table, 10);
+    for(i = 0; i < TEST_KEYS; i++) hashtable_insert(table, &keys[i]);
+    for(i = TEST_KEYS; i < TEST_KEYS * 2; i++) hashtable_query(table, &keys[i]);
+    CHECK(hashtable_get_metrics(table, &metrics));
+    CHECK(metrics.misses == TEST_KEYS);
+    CHECK(metrics.filter_rejects + metrics.filter_false_positives == TEST_KEYS);
+    CHECK(metrics.filter_false_positives < TEST_KEYS / 20);
+    hashtable_free(table, NULL);
+}
+
+static void test_concurrent_metrics(void){
+    struct hashtable_concurrent * table = hashtable_concurrent_init(hash64_uint64_t, equal_uint64_t);
+    struct hashtable_metrics metrics;
+    hash_type i;
+
+    for(i = 0; i < TEST_KEYS; i++) hashtable_concurrent_insert(table, &keys[i]);
+    for(i = 0; i < TEST_KEYS * 2; i++) hashtable_concurrent_query(table, &keys[i]);
+    for(i = 0; i < TEST_KEYS / 2; i++) hashtable_concurrent_delete(table, &keys[i], NULL);
+
+    CHECK(hashtable_concurrent_get_metrics(table, &metrics));
+    test_check_counters(&metrics);
+    CHECK(metrics.items == TEST_KEYS / 2);
+    hashtable_concurrent_free(table, NULL);
+}
+
+int main(void){
+    TEST_RUN(test_hashtable_metrics);
+    TEST_RUN(test_compact_metrics);
+    TEST_RUN(test_filter_metrics);
+    TEST_RUN(test_concurrent_metrics);
+    return test_result();
+}
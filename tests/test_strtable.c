@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/strtable.h"
+#include "test.h"
+
+#define TEST_KEYS           (20000)
+
+static int destroyed;
+
+static void test_destroy(void * value){
+    (void)value;
+    destroyed++;
+}
+
+/* Lengths 0 to 63, so keys land on both sides of STRTABLE_INLINE_KEY */
+static size_t test_key(char * buffer, hash_type i){
+    size_t length = i % 64;
+
+    memset(buffer, 'a' + (char)(i % 26), length);
+    if(length >= 8) snprintf(buffer + length - 8, 9, "%08llx", (unsigned long long)i);
+    return length;
+}
+
+static void test_insert_get_remove(void){
+    struct strtable * table = strtable_init();
+    char buffer[64];
+    size_t length;
+    hash_type i, added = 0;
+    bool inserted;
+
+    for(i = 0; i < TEST_KEYS; i++){
+        length = test_key(buffer, i);
+        *strtable_get_or_insert(table, buffer, length, &inserted) = (void*)(uintptr_t)(i + 1);
+        CHECK(inserted || length < 8);
+        added += inserted;
+        /* The table owns a copy, the buffer is free to change */
+        memset(buffer, 0, sizeof(buffer));
+    }
+    /* Keys shorter than the hex suffix repeat, each is stored once */
+    CHECK(table->items == added && added > TEST_KEYS - TEST_KEYS / 8);
+    for(i = 64; i < TEST_KEYS; i++){
+        length = test_key(buffer, i);
+        if(length < 8) continue;
+        CHECK(strtable_get(table, buffer, length) == (void*)(uintptr_t)(i + 1));
+        buffer[0] ^= 1;
+        CHECK(strtable_get(table, buffer, length) == NULL);
+        buffer[0] ^= 1;
+        CHECK(strtable_get(table, buffer, length - 1) == NULL);
+    }
+    for(i = 64; i < TEST_KEYS; i += 2){
+        length = test_key(buffer, i);
+        if(length >= 8) CHECK(strtable_remove(table, buffer, length, NULL));
+    }
+    for(i = 64; i < TEST_KEYS; i++){
+        length = test_key(buffer, i);
+        if(length >= 8) CHECK(strtable_get(table, buffer, length) == (i % 2 ? (void*)(uintptr_t)(i + 1) : NULL));
+    }
+    destroyed = 0;
+    length = table->items;
+    strtable_free(table, test_destroy);
+    CHECK(destroyed == (int)length);
+}
+
+static void test_upsert_binary(void){
+    struct strtable * table = strtable_init_size(1);
+    char key[] = "long key with\0an embedded NUL, past the inline bytes";
+    void * value;
+
+    CHECK(strtable_upsert(table, key, sizeof(key), &destroyed) == NULL);
+    CHECK(strtable_upsert(table, key, sizeof(key), table) == &destroyed);
+    CHECK(strtable_get(table, key, 13) == NULL);
+    CHECK(strtable_upsert(table, "", 0, key) == NULL);
+    CHECK(strtable_get(table, "", 0) == key && table->items == 2);
+    CHECK(strtable_remove(table, key, sizeof(key), &value) && value == table);
+    CHECK(!strtable_remove(table, key, sizeof(key), NULL));
+    CHECK(table->items == 1);
+    strtable_free(table, NULL);
+}
+
+int main(void){
+    TEST_RUN(test_insert_get_remove);
+    TEST_RUN(test_upsert_binary);
+    return test_result();
+}
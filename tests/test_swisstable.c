@@ -0,0 +1,79 @@
+/*
+ * Copyright (c) 2015 Rafael Kallis <rafael@rafaelkallis.com>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+
+#include "../include/swisstable.h"
+#include "../include/hashfunc.h"
+#include "../include/equalfunc.h"
+#include "test.h"
+
+#define TEST_KEYS           (20000)
+
+static uint64_t keys[TEST_KEYS];
+static int destroyed;
+
+static void test_destroy(void * data){
+    (void)data;
+    destroyed++;
+}
+
+static void test_insert_query_delete(void){
+    struct swisstable * table = swisstable_init(hash64_uint64_t, equal_uint64_t);
+    hash_type i;
+    uint64_t probe;
+
+    destroyed = 0;
+    for(i = 0; i < TEST_KEYS; i++){
+        keys[i] = i * 7 + 3;
+        swisstable_insert(table, &keys[i]);
+    }
+    CHECK(table->items == TEST_KEYS);
+    for(i = 0; i < TEST_KEYS; i += 2)
+        swisstable_delete(table, &keys[i], test_destroy);
+    CHECK(destroyed == TEST_KEYS / 2);
+    CHECK(table->items == TEST_KEYS / 2);
+    for(i = 0; i < TEST_KEYS; i++){
+        probe = i * 7 + 3;
+        CHECK(swisstable_query(table, &probe) == (i % 2 ? &keys[i] : NULL));
+    }
+    probe = 1;
+    CHECK(swisstable_query(table, &probe) == NULL);
+    swisstable_free(table, test_destroy);
+    CHECK(destroyed == TEST_KEYS);
+}
+
+/* Repeated insert/delete cycles must recycle tombstones instead of growing */
+static void test_tombstones(void){
+    struct swisstable * table = swisstable_init_size(hash64_uint64_t, equal_uint64_t, 64);
+    hash_type i, round;
+
+    for(round = 0; round < 50; round++){
+        for(i = 0; i < 32; i++){
+            keys[i] = round * 32 + i;
+            swisstable_insert(table, &keys[i]);
+        }
+        for(i = 0; i < 32; i++)
+            swisstable_delete(table, &keys[i], NULL);
+    }
+    CHECK(table->items == 0);
+    CHECK(table->group_size_exponent <= 3);
+    swisstable_free(table, NULL);
+}
+
+int main(void){
+    TEST_RUN(test_insert_query_delete);
+    TEST_RUN(test_tombstones);
+    return test_result();
+}